@@ -0,0 +1,161 @@
+// <hyx/category.h> -*- C++ -*-
+// Copyright (C) 2023 Michael Pollak
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef HYX_CATEGORY_H
+#define HYX_CATEGORY_H
+
+#include <atomic>
+#include <functional>
+#include <hyx/logger.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+namespace hyx {
+    class log_categories;
+
+    // a named part of a program ("net.http.client") that logs through a shared logger; its
+    // level is its own if one was set, or else its parent's (the root's is trace unless set)
+    class log_category {
+    public:
+        // not copyable or movable
+        explicit log_category(const log_category&) = delete;
+        explicit log_category(log_category&&) = delete;
+        log_category& operator=(const log_category&) = delete;
+        log_category& operator=(log_category&&) = delete;
+
+        template<typename... Args>
+        void operator()(const format_string_with_location<std::type_identity_t<Args>...>& fmt, Args&&... args)
+        {
+            log_category::operator()(logger_literals::info, fmt, std::forward<Args>(args)...);
+        }
+
+        template<typename... Args>
+        void operator()(const call_site& site, const format_string_with_location<std::type_identity_t<Args>...>& fmt, Args&&... args)
+        {
+            if (!site.enabled.load(std::memory_order_relaxed)) [[unlikely]] {
+                return;
+            }
+
+            log_category::operator()(site.level, fmt, std::forward<Args>(args)...);
+        }
+
+        // the category's level takes the place of the logger's threshold
+        template<typename... Args>
+        void operator()(log_level lvl, const format_string_with_location<std::type_identity_t<Args>...>& fmt, Args&&... args)
+        {
+            output_.log(effective_.load(std::memory_order_relaxed), lvl, fmt, std::forward<Args>(args)...);
+        }
+
+        [[nodiscard]] std::string_view name() const noexcept
+        {
+            return name_;
+        }
+
+        // whether records at lvl currently get through (e.g., to skip preparing expensive arguments)
+        [[nodiscard]] bool enabled_for(log_level lvl) const noexcept
+        {
+            const auto tl = detail::thread_threshold;
+            return lvl.severity() >= (tl != detail::no_threshold ? tl : effective_.load(std::memory_order_relaxed));
+        }
+
+    private:
+        friend class log_categories;
+
+        log_category(logger& output, std::string name, log_category* parent) : output_(output), name_(std::move(name)), parent_(parent), effective_(parent != nullptr ? parent->effective_.load(std::memory_order_relaxed) : logger_literals::trace.severity()) {}
+
+        logger& output_;
+        std::string name_;
+        log_category* parent_;
+
+        // guarded by the registry's mutex
+        std::optional<int> level_{};
+
+        // level_ or the parent's effective level, recomputed whenever any level changes
+        std::atomic<int> effective_;
+    };
+
+    // owns the categories logging through one logger (and so sharing its sinks and header)
+    class log_categories {
+    public:
+        // not copyable or movable
+        explicit log_categories(const log_categories&) = delete;
+        explicit log_categories(log_categories&&) = delete;
+        log_categories& operator=(const log_categories&) = delete;
+        log_categories& operator=(log_categories&&) = delete;
+
+        explicit log_categories(logger& output) : output_(output)
+        {
+            categories_.emplace("", std::unique_ptr<log_category>{new log_category(output_, "", nullptr)});
+        }
+
+        // the category (created with any missing parents on first use), which lives as long as the registry;
+        // "" is the root
+        log_category& get(std::string_view name)
+        {
+            const std::lock_guard lock{mutex_};
+            return find_or_create(name);
+        }
+
+        void set_level(std::string_view name, log_level lvl)
+        {
+            const std::lock_guard lock{mutex_};
+            find_or_create(name).level_ = lvl.severity();
+            propagate();
+        }
+
+        // makes the category follow its parent again
+        void clear_level(std::string_view name)
+        {
+            const std::lock_guard lock{mutex_};
+            find_or_create(name).level_.reset();
+            propagate();
+        }
+
+    private:
+        log_category& find_or_create(std::string_view name)
+        {
+            if (const auto it = categories_.find(name); it != categories_.end()) {
+                return *it->second;
+            }
+
+            const auto dot = name.rfind('.');
+            auto& parent = find_or_create(dot == std::string_view::npos ? std::string_view{} : name.substr(0, dot));
+            auto& cat = categories_.emplace(std::string{name}, std::unique_ptr<log_category>{new log_category(output_, std::string{name}, &parent)}).first->second;
+            return *cat;
+        }
+
+        // a parent's name is a prefix of its children's, so it's always visited first
+        void propagate()
+        {
+            for (auto& [name, cat] : categories_) {
+                const auto inherited = cat->parent_ != nullptr ? cat->parent_->effective_.load(std::memory_order_relaxed) : logger_literals::trace.severity();
+                cat->effective_.store(cat->level_.value_or(inherited), std::memory_order_relaxed);
+            }
+        }
+
+        logger& output_;
+        std::mutex mutex_;
+        std::map<std::string, std::unique_ptr<log_category>, std::less<>> categories_;
+    };
+} // namespace hyx
+
+#endif // !HYX_CATEGORY_H
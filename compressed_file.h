@@ -0,0 +1,529 @@
+// <hyx/compressed_file.h> -*- C++ -*-
+// Copyright (C) 2023 Michael Pollak
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef HYX_COMPRESSED_FILE_H
+#define HYX_COMPRESSED_FILE_H
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <istream>
+#include <limits>
+#include <mutex>
+#include <optional>
+#include <ostream>
+#include <stdexcept>
+#include <streambuf>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+
+#if defined(HYX_USE_LZ4) && __has_include(<lz4.h>)
+#include <lz4.h>
+#define HYX_HAS_LZ4 1
+#endif
+
+// file layout: a sequence of independently decodable blocks, each preceded by
+//   "HYXB" | u8 version | u8 codec | u16 reserved | u32 raw size | u32 stored size |
+//   u64 raw offset | u32 fnv-1a of the raw bytes
+// (all little-endian). a block whose header or payload is cut short marks the end of
+// the readable data, so a crash loses at most the blocks that were still in flight.
+
+namespace hyx {
+    struct block_compression {
+        // uncompressed bytes per block
+        std::size_t block_size{64 * 1024};
+
+        // a partially filled block is written once it is this old
+        std::chrono::milliseconds max_delay{1000};
+    };
+
+    namespace detail {
+        enum class block_codec : std::uint8_t {
+            stored,
+            lz4
+        };
+
+        inline constexpr std::array<char, 4> block_magic{'H', 'Y', 'X', 'B'};
+        inline constexpr std::uint8_t block_version{1};
+        inline constexpr std::size_t block_header_size{28};
+
+        constexpr std::uint32_t fnv1a(std::string_view bytes) noexcept
+        {
+            std::uint32_t hash = 2166136261u;
+            for (const char c : bytes) {
+                hash = (hash ^ static_cast<unsigned char>(c)) * 16777619u;
+            }
+
+            return hash;
+        }
+
+        template<typename UInt>
+        void put_le(std::string& out, UInt value)
+        {
+            for (std::size_t i = 0; i < sizeof(UInt); ++i) {
+                out.push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+            }
+        }
+
+        template<typename UInt>
+        UInt get_le(const char* in) noexcept
+        {
+            UInt value = 0;
+            for (std::size_t i = 0; i < sizeof(UInt); ++i) {
+                value |= static_cast<UInt>(static_cast<unsigned char>(in[i])) << (8 * i);
+            }
+
+            return value;
+        }
+
+        struct block_header {
+            block_codec codec;
+            std::uint32_t raw_size;
+            std::uint32_t stored_size;
+            std::uint64_t raw_offset;
+            std::uint32_t checksum;
+        };
+
+        inline std::optional<block_header> parse_block_header(const char* in) noexcept
+        {
+            if (std::memcmp(in, block_magic.data(), block_magic.size()) != 0 || static_cast<std::uint8_t>(in[4]) != block_version || static_cast<std::uint8_t>(in[5]) > static_cast<std::uint8_t>(block_codec::lz4)) {
+                return std::nullopt;
+            }
+
+            return block_header{static_cast<block_codec>(in[5]), get_le<std::uint32_t>(in + 8), get_le<std::uint32_t>(in + 12), get_le<std::uint64_t>(in + 16), get_le<std::uint32_t>(in + 24)};
+        }
+
+        // *********************************************************************
+        // lz4 block format (https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md)
+        // *********************************************************************
+
+        inline constexpr std::size_t lz4_min_match{4};
+        // the last match must start at least 12 bytes before the end and the last 5 bytes are always literals
+        inline constexpr std::size_t lz4_match_limit{12};
+        inline constexpr std::size_t lz4_last_literals{5};
+
+        inline void lz4_put_length(std::string& out, std::size_t len)
+        {
+            for (; len >= 255; len -= 255) {
+                out.push_back(static_cast<char>(255));
+            }
+            out.push_back(static_cast<char>(len));
+        }
+
+        inline void lz4_put_sequence(std::string& out, std::string_view literals, std::size_t offset, std::size_t match_len)
+        {
+            const auto lit = literals.size();
+            const auto ml = match_len == 0 ? 0 : match_len - lz4_min_match;
+
+            out.push_back(static_cast<char>((std::min<std::size_t>(lit, 15) << 4) | (match_len == 0 ? 0 : std::min<std::size_t>(ml, 15))));
+            if (lit >= 15) {
+                lz4_put_length(out, lit - 15);
+            }
+            out.append(literals);
+
+            if (match_len != 0) {
+                put_le(out, static_cast<std::uint16_t>(offset));
+                if (ml >= 15) {
+                    lz4_put_length(out, ml - 15);
+                }
+            }
+        }
+
+        // greedy single-probe compressor; not as tight as liblz4 but fully compatible with it
+        inline void lz4_compress(std::string_view src, std::string& out)
+        {
+#ifdef HYX_HAS_LZ4
+            out.resize(static_cast<std::size_t>(LZ4_compressBound(static_cast<int>(src.size()))));
+            out.resize(static_cast<std::size_t>(LZ4_compress_default(src.data(), out.data(), static_cast<int>(src.size()), static_cast<int>(out.size()))));
+#else
+            constexpr std::size_t hash_bits = 12;
+            std::array<std::uint32_t, std::size_t{1} << hash_bits> table{}; // position + 1, 0 is empty
+
+            const auto read32 = [&](std::size_t pos) {
+                std::uint32_t v;
+                std::memcpy(&v, src.data() + pos, sizeof(v));
+                return v;
+            };
+            const auto hash = [&](std::uint32_t v) { return (v * 2654435761u) >> (32 - hash_bits); };
+
+            out.clear();
+            std::size_t anchor = 0;
+
+            if (src.size() > lz4_match_limit) {
+                const auto match_start_limit = src.size() - lz4_match_limit;
+                const auto match_end_limit = src.size() - lz4_last_literals;
+
+                for (std::size_t ip = 0; ip < match_start_limit;) {
+                    const auto seq = read32(ip);
+                    auto& slot = table[hash(seq)];
+                    const auto candidate = static_cast<std::size_t>(slot);
+                    slot = static_cast<std::uint32_t>(ip + 1);
+
+                    if (candidate == 0 || ip - (candidate - 1) > 0xffff || read32(candidate - 1) != seq) {
+                        ++ip;
+                        continue;
+                    }
+
+                    const auto ref = candidate - 1;
+                    auto len = lz4_min_match;
+                    while (ip + len < match_end_limit && src[ref + len] == src[ip + len]) {
+                        ++len;
+                    }
+
+                    lz4_put_sequence(out, src.substr(anchor, ip - anchor), ip - ref, len);
+                    ip += len;
+                    anchor = ip;
+                }
+            }
+
+            lz4_put_sequence(out, src.substr(anchor), 0, 0);
+#endif
+        }
+
+        // returns false if the input is not a valid block of exactly raw_size bytes
+        inline bool lz4_decompress(std::string_view src, std::size_t raw_size, std::string& out)
+        {
+            out.clear();
+            out.reserve(raw_size);
+
+            std::size_t ip = 0;
+            const auto get_length = [&](std::size_t len) -> std::optional<std::size_t> {
+                if (len != 15) {
+                    return len;
+                }
+
+                for (unsigned char b = 255; b == 255; len += b) {
+                    if (ip == src.size()) {
+                        return std::nullopt;
+                    }
+                    b = static_cast<unsigned char>(src[ip++]);
+                }
+
+                return len;
+            };
+
+            while (ip < src.size()) {
+                const auto token = static_cast<unsigned char>(src[ip++]);
+
+                const auto lit = get_length(token >> 4);
+                if (!lit || *lit > src.size() - ip || out.size() + *lit > raw_size) {
+                    return false;
+                }
+                out.append(src.substr(ip, *lit));
+                ip += *lit;
+
+                // the last sequence has no match part
+                if (ip == src.size()) {
+                    break;
+                }
+
+                if (src.size() - ip < 2) {
+                    return false;
+                }
+                const auto offset = get_le<std::uint16_t>(src.data() + ip);
+                ip += 2;
+
+                const auto ml = get_length(token & 15);
+                if (!ml || offset == 0 || offset > out.size() || out.size() + *ml + lz4_min_match > raw_size) {
+                    return false;
+                }
+
+                // matches may overlap their own output, so copy byte by byte
+                for (auto from = out.size() - offset, n = *ml + lz4_min_match; n != 0; --n) {
+                    out.push_back(out[from++]);
+                }
+            }
+
+            return out.size() == raw_size;
+        }
+
+        inline void encode_block(std::string_view raw, std::uint64_t raw_offset, std::string& payload, std::string& out)
+        {
+            lz4_compress(raw, payload);
+
+            // text that doesn't compress is kept as is
+            auto codec = block_codec::lz4;
+            if (payload.size() >= raw.size()) {
+                codec = block_codec::stored;
+                payload.assign(raw);
+            }
+
+            out.clear();
+            out.append(block_magic.data(), block_magic.size());
+            out.push_back(static_cast<char>(block_version));
+            out.push_back(static_cast<char>(codec));
+            put_le(out, std::uint16_t{0});
+            put_le(out, static_cast<std::uint32_t>(raw.size()));
+            put_le(out, static_cast<std::uint32_t>(payload.size()));
+            put_le(out, raw_offset);
+            put_le(out, fnv1a(raw));
+            out.append(payload);
+        }
+
+        // reads one block into raw, returning its header or nullopt at the end of the readable data
+        inline std::optional<block_header> read_block(std::istream& in, std::string& payload, std::string& raw)
+        {
+            std::array<char, block_header_size> hdr_bytes;
+            if (!in.read(hdr_bytes.data(), hdr_bytes.size())) {
+                return std::nullopt;
+            }
+
+            const auto hdr = parse_block_header(hdr_bytes.data());
+            if (!hdr) {
+                return std::nullopt;
+            }
+
+            payload.resize(hdr->stored_size);
+            if (!in.read(payload.data(), static_cast<std::streamsize>(payload.size()))) {
+                return std::nullopt;
+            }
+
+            if (hdr->codec == block_codec::stored) {
+                raw = payload;
+            }
+            else if (!lz4_decompress(payload, hdr->raw_size, raw)) {
+                return std::nullopt;
+            }
+
+            if (raw.size() != hdr->raw_size || fnv1a(raw) != hdr->checksum) {
+                return std::nullopt;
+            }
+
+            return hdr;
+        }
+    } // namespace detail
+
+    // writes the decoded contents of a compressed log to out and
+    // returns false if the file ends in a partially written block
+    inline bool decompress_log(std::istream& in, std::ostream& out)
+    {
+        std::string payload;
+        std::string raw;
+        while (detail::read_block(in, payload, raw)) {
+            out.write(raw.data(), static_cast<std::streamsize>(raw.size()));
+        }
+
+        return in.eof() && in.gcount() == 0;
+    }
+
+    // a write-only streambuf that compresses whole blocks on a background thread
+    class compressed_filebuf : public std::streambuf {
+    public:
+        // not copyable or movable
+        explicit compressed_filebuf(const compressed_filebuf&) = delete;
+        explicit compressed_filebuf(compressed_filebuf&&) = delete;
+        compressed_filebuf& operator=(const compressed_filebuf&) = delete;
+        compressed_filebuf& operator=(compressed_filebuf&&) = delete;
+
+        explicit compressed_filebuf(const std::filesystem::path& path, block_compression opts = {}) : opts_(opts)
+        {
+            if (path.filename().empty()) {
+                throw std::invalid_argument("log output path does not contain a filename");
+            }
+            if (opts_.block_size == 0 || opts_.block_size > std::numeric_limits<std::uint32_t>::max()) {
+                throw std::invalid_argument("block size must be between 1 byte and 4 GiB");
+            }
+
+            recover(path);
+            file_.open(path, std::ios_base::binary | std::ios_base::app);
+            if (!file_) {
+                throw std::runtime_error("could not open compressed log output");
+            }
+
+            block_.reserve(opts_.block_size);
+            worker_ = std::jthread([this](std::stop_token st) { work(st); });
+        }
+
+        ~compressed_filebuf() override
+        {
+            {
+                // stop under the lock so the worker can't miss the wakeup
+                std::lock_guard lock(mutex_);
+                seal();
+                worker_.request_stop();
+            }
+            work_cv_.notify_one();
+            worker_.join();
+        }
+
+    protected:
+        // each call is kept whole within a block (the sink hands over one record per call), so a block
+        // lost in a crash never leaves a torn record behind; a call longer than a block gets one to itself
+        std::streamsize xsputn(const char_type* s, std::streamsize n) override
+        {
+            const std::string_view data{s, static_cast<std::size_t>(n)};
+            if (data.empty()) {
+                return n;
+            }
+
+            std::lock_guard lock(mutex_);
+            if (!block_.empty() && block_.size() + data.size() > opts_.block_size) {
+                seal();
+            }
+            if (block_.empty()) {
+                block_started_ = std::chrono::steady_clock::now();
+            }
+
+            block_.append(data);
+            if (block_.size() >= opts_.block_size) {
+                seal();
+            }
+
+            return n;
+        }
+
+        int_type overflow(int_type ch) override
+        {
+            if (traits_type::eq_int_type(ch, traits_type::eof())) {
+                return traits_type::not_eof(ch);
+            }
+
+            const auto c = traits_type::to_char_type(ch);
+            xsputn(&c, 1);
+            return ch;
+        }
+
+        // writes everything buffered so far and waits for it to reach the file
+        int sync() override
+        {
+            std::unique_lock lock(mutex_);
+            seal();
+            // (other threads may seal and the worker write more blocks before this one wakes up)
+            const auto target = sealed_;
+            done_cv_.wait(lock, [&] { return written_ >= target; });
+            return write_failed_ ? -1 : 0;
+        }
+
+    private:
+        struct pending_block {
+            std::string raw;
+            std::uint64_t raw_offset;
+        };
+
+        // drops a partially written tail left behind by a crash so new blocks stay reachable; a file
+        // that doesn't start like a compressed log is refused rather than cut down
+        void recover(const std::filesystem::path& path)
+        {
+            std::error_code ec;
+            const auto size = std::filesystem::file_size(path, ec);
+            if (ec || size == 0) {
+                return;
+            }
+
+            std::ifstream in(path, std::ios_base::binary);
+            std::array<char, detail::block_header_size> lead{};
+            in.read(lead.data(), lead.size());
+            const auto got = static_cast<std::size_t>(in.gcount());
+
+            // (a crash may have cut even the first header short)
+            const bool ours = got == lead.size() ? detail::parse_block_header(lead.data()).has_value() : std::memcmp(lead.data(), detail::block_magic.data(), std::min(got, detail::block_magic.size())) == 0;
+            if (!ours) {
+                throw std::invalid_argument("log output exists and is not a compressed log");
+            }
+
+            in.clear();
+            in.seekg(0);
+            std::string payload;
+            std::string raw;
+            std::uintmax_t valid_end = 0;
+            while (const auto hdr = detail::read_block(in, payload, raw)) {
+                valid_end += detail::block_header_size + hdr->stored_size;
+                raw_offset_ = hdr->raw_offset + hdr->raw_size;
+            }
+            in.close();
+
+            if (valid_end != size) {
+                std::filesystem::resize_file(path, valid_end);
+            }
+        }
+
+        // requires mutex_
+        void seal()
+        {
+            if (block_.empty()) {
+                return;
+            }
+
+            queue_.push_back({std::exchange(block_, {}), raw_offset_});
+            raw_offset_ += queue_.back().raw.size();
+            block_.reserve(opts_.block_size);
+            ++sealed_;
+            work_cv_.notify_one();
+        }
+
+        void work(std::stop_token st)
+        {
+            std::string payload;
+            std::string encoded;
+
+            std::unique_lock lock(mutex_);
+            while (true) {
+                work_cv_.wait_for(lock, opts_.max_delay, [&] { return st.stop_requested() || !queue_.empty(); });
+
+                if (queue_.empty() && !block_.empty() && std::chrono::steady_clock::now() - block_started_ >= opts_.max_delay) {
+                    seal();
+                }
+
+                while (!queue_.empty()) {
+                    auto blk = std::move(queue_.front());
+                    queue_.pop_front();
+
+                    // compress and write without holding up producers
+                    lock.unlock();
+                    detail::encode_block(blk.raw, blk.raw_offset, payload, encoded);
+                    file_.write(encoded.data(), static_cast<std::streamsize>(encoded.size()));
+                    file_.flush();
+                    const bool ok = static_cast<bool>(file_);
+                    lock.lock();
+
+                    write_failed_ = write_failed_ || !ok;
+                    ++written_;
+                    done_cv_.notify_all();
+                }
+
+                if (st.stop_requested()) {
+                    return;
+                }
+            }
+        }
+
+        block_compression opts_;
+        std::ofstream file_;
+
+        std::mutex mutex_;
+        std::condition_variable work_cv_;
+        std::condition_variable done_cv_;
+        std::string block_;
+        std::chrono::steady_clock::time_point block_started_;
+        std::deque<pending_block> queue_;
+        std::uint64_t raw_offset_{0};
+        std::uint64_t sealed_{0};
+        std::uint64_t written_{0};
+        // only the worker touches file_, so its state is reported through here
+        bool write_failed_{false};
+        std::jthread worker_;
+    };
+} // namespace hyx
+
+#endif // !HYX_COMPRESSED_FILE_H
@@ -0,0 +1,344 @@
+// <hyx/fd_sink.h> -*- C++ -*-
+// Copyright (C) 2023 Michael Pollak
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef HYX_FD_SINK_H
+#define HYX_FD_SINK_H
+
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <hyx/sink.h>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#if defined(__linux__) && defined(F_GETPIPE_SZ) && defined(SPLICE_F_NONBLOCK)
+#define HYX_HAS_VMSPLICE 1
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#endif
+
+// sinks writing straight to a posix file descriptor, without iostreams
+
+namespace hyx {
+    namespace detail {
+        // write() until everything is out; only a short write (a full disk, a signal) takes more than one call
+        inline void write_fully(int fd, std::string_view bytes)
+        {
+            while (!bytes.empty()) {
+                const auto n = ::write(fd, bytes.data(), bytes.size());
+                if (n < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    throw std::system_error(errno, std::generic_category(), "could not write log output");
+                }
+                bytes.remove_prefix(static_cast<std::size_t>(n));
+            }
+        }
+
+        // the longest prefix of at most `limit` bytes that ends a line, or failing that, doesn't split a utf-8 sequence
+        inline std::size_t split_point(std::string_view bytes, std::size_t limit) noexcept
+        {
+            const auto nl = bytes.substr(0, limit).rfind('\n');
+            if (nl != std::string_view::npos) {
+                return nl + 1;
+            }
+
+            auto cut = limit;
+            while (cut != 0 && (static_cast<unsigned char>(bytes[cut]) & 0xc0) == 0x80) {
+                --cut;
+            }
+            return cut != 0 ? cut : limit;
+        }
+
+        inline std::size_t checked_batch_bytes(std::size_t batch_bytes)
+        {
+            if (batch_bytes == 0) {
+                throw std::invalid_argument("batch size must be at least 1 byte");
+            }
+            return batch_bytes;
+        }
+
+#ifdef HYX_HAS_VMSPLICE
+        // page-aligned memory whose pages are handed to a pipe with vmsplice(). the pipe keeps
+        // referring to them after the call, so a page is only written again once enough later
+        // pages went in after it that the pipe (a fifo of at most pipe size / page size pages)
+        // must have let go of it. this only holds while the reader read()s from the pipe: pages
+        // it tee()s or splice()s on to another pipe live on there
+        class splice_ring {
+        public:
+            // not copyable or movable
+            explicit splice_ring(const splice_ring&) = delete;
+            explicit splice_ring(splice_ring&&) = delete;
+            splice_ring& operator=(const splice_ring&) = delete;
+            splice_ring& operator=(splice_ring&&) = delete;
+
+            splice_ring(int pipe, std::size_t batch_bytes) : pipe_(pipe), page_(static_cast<std::size_t>(::sysconf(_SC_PAGESIZE))), batch_pages_((batch_bytes + page_ - 1) / page_)
+            {
+                remap(pipe_slots());
+            }
+
+            ~splice_ring()
+            {
+                ::munmap(base_, stamps_.size() * page_);
+            }
+
+            // whether fd is a pipe that vmsplice() can write to
+            static bool usable(int fd) noexcept
+            {
+                struct stat st{};
+                return ::fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode) && ::fcntl(fd, F_GETPIPE_SZ) > 0;
+            }
+
+            // room for a batch that the pipe no longer refers to
+            char* acquire()
+            {
+                if (next_ + batch_pages_ > stamps_.size()) {
+                    next_ = 0;
+                }
+
+                // (the reader may have grown the pipe since)
+                const auto slots = pipe_slots();
+                for (auto i = next_; i != next_ + batch_pages_; ++i) {
+                    if (stamps_[i] != 0 && spliced_ - stamps_[i] < slots) {
+                        remap(slots);
+                        break;
+                    }
+                }
+                return base_ + next_ * page_;
+            }
+
+            // moves the first size bytes at acquire()'s region into the pipe; returns how many went in
+            // before the pipe refused vmsplice() (the rest has to be write()n)
+            std::size_t splice(std::size_t size)
+            {
+                iovec iov{base_ + next_ * page_, size};
+                while (iov.iov_len != 0) {
+                    const auto n = ::vmsplice(pipe_, &iov, 1, 0);
+                    if (n < 0) {
+                        if (errno == EINTR) {
+                            continue;
+                        }
+                        if (errno == EINVAL || errno == ENOSYS) {
+                            break;
+                        }
+                        throw std::system_error(errno, std::generic_category(), "could not write log output");
+                    }
+                    iov.iov_base = static_cast<char*>(iov.iov_base) + n;
+                    iov.iov_len -= static_cast<std::size_t>(n);
+                }
+
+                const auto sent = size - iov.iov_len;
+                for (auto used = (sent + page_ - 1) / page_; used != 0; --used) {
+                    stamps_[next_++] = ++spliced_;
+                }
+                return sent;
+            }
+
+        private:
+            std::size_t pipe_slots() const
+            {
+                const auto size = ::fcntl(pipe_, F_GETPIPE_SZ);
+                return size > 0 ? static_cast<std::size_t>(size) / page_ : 0;
+            }
+
+            // a fresh mapping, big enough that going once around it puts more than a pipe's worth of pages
+            // in after each one; the old pages stay valid in the pipe, as unmapping only drops our reference
+            void remap(std::size_t slots)
+            {
+                const auto pages = slots + 2 * batch_pages_;
+                void* mem = ::mmap(nullptr, pages * page_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                if (mem == MAP_FAILED) {
+                    throw std::system_error(errno, std::generic_category(), "could not map log buffer");
+                }
+                if (base_ != nullptr) {
+                    ::munmap(base_, stamps_.size() * page_);
+                }
+
+                base_ = static_cast<char*>(mem);
+                stamps_.assign(pages, 0);
+                next_ = 0;
+            }
+
+            int pipe_;
+            std::size_t page_;
+            std::size_t batch_pages_;
+            char* base_{nullptr};
+            // stamps_[i] is spliced_ just after page i last went into the pipe, or 0
+            std::vector<std::uint64_t> stamps_;
+            std::uint64_t spliced_{0};
+            std::size_t next_{0};
+        };
+#endif
+    } // namespace detail
+
+    // how an fd_sink hands its batches to the kernel
+    enum class fd_transfer {
+        write,
+        // when the descriptor is a pipe, vmsplice() the batch's pages into it instead of having write() copy
+        // them (falls back to write() otherwise); the reader must consume the pipe with read()
+        vmsplice
+    };
+
+    // writes records to a file descriptor with write(2), batching them in its own buffer; the
+    // header is rendered by the logger as for any sink, so no stream is involved at any point
+    //
+    // records that aren't flushed are batched up to batch_bytes, and a batch always goes out in
+    // one write() (or vmsplice(), see fd_transfer); a record longer than that is written in pieces of at most batch_bytes, split
+    // after a newline where it has one
+    class fd_sink : public log_sink {
+    public:
+        // not copyable or movable
+        explicit fd_sink(const fd_sink&) = delete;
+        explicit fd_sink(fd_sink&&) = delete;
+        fd_sink& operator=(const fd_sink&) = delete;
+        fd_sink& operator=(fd_sink&&) = delete;
+
+        // fd stays open and owned by the caller (e.g., STDOUT_FILENO or STDERR_FILENO; output
+        // written there through stdio or iostreams isn't ordered with this sink's)
+        explicit fd_sink(int fd, std::size_t batch_bytes = 64 * 1024, fd_transfer transfer = fd_transfer::write) : fd_sink(fd, false, batch_bytes, transfer) {}
+
+        ~fd_sink() override
+        {
+            try {
+                drain();
+            }
+            catch (...) {
+            }
+            if (owned_) {
+                ::close(fd_);
+            }
+        }
+
+        void write(std::string_view record, std::chrono::system_clock::time_point, bool flush) override
+        {
+            const std::lock_guard lock{mutex_};
+            if (size_ + record.size() > batch_bytes_) {
+                drain();
+            }
+
+            if (record.size() > batch_bytes_) {
+                while (!record.empty()) {
+                    const auto n = record.size() > batch_bytes_ ? detail::split_point(record, batch_bytes_) : record.size();
+                    detail::write_fully(fd_, record.substr(0, n));
+                    record.remove_prefix(n);
+                }
+                return;
+            }
+
+            std::memcpy(batch_ + size_, record.data(), record.size());
+            size_ += record.size();
+            if (flush) {
+                drain();
+            }
+        }
+
+        void flush() override
+        {
+            const std::lock_guard lock{mutex_};
+            drain();
+        }
+
+    protected:
+        // takes ownership of fd if owned is set
+        fd_sink(int fd, bool owned, std::size_t batch_bytes, fd_transfer transfer) : fd_(fd), owned_(owned), batch_bytes_(detail::checked_batch_bytes(batch_bytes))
+        {
+#ifdef HYX_HAS_VMSPLICE
+            if (transfer == fd_transfer::vmsplice && detail::splice_ring::usable(fd_)) {
+                ring_ = std::make_unique<detail::splice_ring>(fd_, batch_bytes_);
+                batch_ = ring_->acquire();
+                return;
+            }
+#else
+            static_cast<void>(transfer);
+#endif
+            buffer_.resize(batch_bytes_);
+            batch_ = buffer_.data();
+        }
+
+    private:
+        void drain()
+        {
+            if (size_ == 0) {
+                return;
+            }
+
+#ifdef HYX_HAS_VMSPLICE
+            if (ring_) {
+                const auto sent = ring_->splice(size_);
+                if (sent == size_) {
+                    batch_ = ring_->acquire();
+                    size_ = 0;
+                    return;
+                }
+
+                // the pipe doesn't take vmsplice() after all
+                buffer_.resize(batch_bytes_);
+                std::memcpy(buffer_.data(), batch_ + sent, size_ - sent);
+                size_ -= sent;
+                batch_ = buffer_.data();
+                ring_.reset();
+            }
+#endif
+            detail::write_fully(fd_, {batch_, size_});
+            size_ = 0;
+        }
+
+        std::mutex mutex_;
+        int fd_;
+        bool owned_;
+        std::size_t batch_bytes_;
+        // the pending batch, in buffer_ or in ring_
+        char* batch_{nullptr};
+        std::size_t size_{0};
+        std::vector<char> buffer_;
+#ifdef HYX_HAS_VMSPLICE
+        std::unique_ptr<detail::splice_ring> ring_;
+#endif
+    };
+
+    // appends to a file opened with O_APPEND; as every record (or batch of them) is a single
+    // write(), processes sharing the file never tear each other's lines
+    class append_file_sink : public fd_sink {
+    public:
+        explicit append_file_sink(const std::filesystem::path& path, std::size_t batch_bytes = 64 * 1024) : fd_sink(open_append(path, batch_bytes), true, batch_bytes, fd_transfer::write) {}
+
+    private:
+        // (the batch size is checked first, so a bad one doesn't leave a descriptor behind)
+        static int open_append(const std::filesystem::path& path, std::size_t batch_bytes)
+        {
+            detail::checked_batch_bytes(batch_bytes);
+            const int fd = ::open(detail::checked_log_path(path).c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+            if (fd < 0) {
+                throw std::system_error(errno, std::generic_category(), "could not open log file");
+            }
+            return fd;
+        }
+    };
+} // namespace hyx
+
+#endif // !HYX_FD_SINK_H
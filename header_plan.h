@@ -0,0 +1,527 @@
+// <hyx/header_plan.h> -*- C++ -*-
+// Copyright (C) 2023 Michael Pollak
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef HYX_HEADER_PLAN_H
+#define HYX_HEADER_PLAN_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <format>
+#include <hyx/header_string.h>
+#include <iterator>
+#include <mutex>
+#include <optional>
+#include <source_location>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#if __has_include(<unistd.h>) && __has_include(<pthread.h>)
+#define HYX_HAS_POSIX_PROCESS 1
+#include <pthread.h>
+#include <unistd.h>
+#if defined(__GLIBC__)
+#include <errno.h>
+#else
+#include <stdlib.h>
+#endif
+#endif
+
+namespace hyx {
+    namespace detail {
+        // taken during static initialization, which is as close to process start as a header gets
+        inline const std::chrono::steady_clock::time_point process_start{std::chrono::steady_clock::now()};
+
+        // when the last record showing [cl::delta;] was written on this thread
+        inline constinit thread_local std::chrono::steady_clock::time_point last_record_time{};
+
+        // "00" through "99", so digits are written in pairs
+        inline constexpr auto two_digits = [] {
+            std::array<char, 200> table{};
+            for (int i = 0; i < 100; ++i) {
+                table[2 * i] = static_cast<char>('0' + i / 10);
+                table[2 * i + 1] = static_cast<char>('0' + i % 10);
+            }
+            return table;
+        }();
+
+        inline char* write_two_digits(char* p, unsigned v) noexcept
+        {
+            std::memcpy(p, &two_digits[2 * v], 2);
+            return p + 2;
+        }
+
+        // the first `digits` (truncated) digits of a nanosecond fraction, always writing all nine
+        // into p (so p needs room for them) but only advancing past the ones asked for
+        inline char* write_fraction(char* p, std::uint32_t ns, int digits) noexcept
+        {
+            *p = static_cast<char>('0' + ns / 100'000'000);
+            ns %= 100'000'000;
+            write_two_digits(p + 1, ns / 1'000'000);
+            write_two_digits(p + 3, ns / 10'000 % 100);
+            write_two_digits(p + 5, ns / 100 % 100);
+            write_two_digits(p + 7, ns % 100);
+            return p + digits;
+        }
+
+        // seconds with `digits` (truncated) fractional digits, without going through std::format
+        template<typename OutIt>
+        OutIt format_fixed_point(OutIt out, std::chrono::nanoseconds d, int digits)
+        {
+            std::array<char, 40> buf;
+            auto* p = buf.data();
+
+            auto ns = d.count();
+            if (ns < 0) {
+                *p++ = '-';
+                ns = -ns;
+            }
+
+            p = std::to_chars(p, buf.data() + buf.size(), ns / 1'000'000'000).ptr;
+            if (digits > 0) {
+                *p++ = '.';
+                p = write_fraction(p, static_cast<std::uint32_t>(ns % 1'000'000'000), digits);
+            }
+
+            return std::copy(buf.data(), p, out);
+        }
+
+        // the civil date and time `d` after 1970-01-01 as yyyy-mm-dd<separator>hh:mm:ss[.fff],
+        // matching chrono's %F and %T
+        template<typename OutIt>
+        OutIt format_iso_timestamp(OutIt out, std::chrono::nanoseconds d, char separator, int digits)
+        {
+            const auto day = std::chrono::floor<std::chrono::days>(d);
+            const std::chrono::year_month_day ymd{std::chrono::sys_days{day}};
+            const auto tod = d - day;
+            const auto secs = static_cast<unsigned>(std::chrono::floor<std::chrono::seconds>(tod).count());
+
+            std::array<char, 48> buf;
+            auto* p = buf.data();
+
+            auto year = static_cast<int>(ymd.year());
+            if (year < 0) {
+                *p++ = '-';
+                year = -year;
+            }
+            if (year < 10'000) [[likely]] {
+                p = write_two_digits(p, static_cast<unsigned>(year) / 100);
+                p = write_two_digits(p, static_cast<unsigned>(year) % 100);
+            }
+            else {
+                p = std::to_chars(p, buf.data() + buf.size(), year).ptr;
+            }
+
+            *p++ = '-';
+            p = write_two_digits(p, static_cast<unsigned>(ymd.month()));
+            *p++ = '-';
+            p = write_two_digits(p, static_cast<unsigned>(ymd.day()));
+            *p++ = separator;
+            p = write_two_digits(p, secs / 3600);
+            *p++ = ':';
+            p = write_two_digits(p, secs / 60 % 60);
+            *p++ = ':';
+            p = write_two_digits(p, secs % 60);
+            if (digits > 0) {
+                *p++ = '.';
+                p = write_fraction(p, static_cast<std::uint32_t>((tod % std::chrono::seconds{1}).count()), digits);
+            }
+
+            return std::copy(buf.data(), p, out);
+        }
+
+        // the zone's offset and abbreviation only change at its transitions, so the tzdb lookup is
+        // redone only once a record falls outside the period of the last one (on either side,
+        // since the system clock can be set back)
+        inline const std::chrono::sys_info& local_zone_info(std::chrono::system_clock::time_point now)
+        {
+            thread_local const std::chrono::time_zone* zone{nullptr};
+            thread_local std::chrono::sys_info info{};
+
+            if (zone == nullptr || now < info.begin || now >= info.end) [[unlikely]] {
+                if (zone == nullptr) {
+                    zone = std::chrono::current_zone();
+                }
+                info = zone->get_info(std::chrono::floor<std::chrono::seconds>(now));
+            }
+
+            return info;
+        }
+
+        // does the tzdb work (parsing the database and leap-second list, finding the current zone)
+        // that the first record showing these clocks would otherwise stall on
+        inline void warm_tzdb(bool local)
+        {
+            const auto now = std::chrono::system_clock::now();
+            static_cast<void>(std::chrono::get_tzdb());
+            static_cast<void>(std::chrono::clock_cast<std::chrono::utc_clock>(now));
+            if (local) {
+                static_cast<void>(std::chrono::current_zone()->get_info(std::chrono::floor<std::chrono::seconds>(now)));
+            }
+        }
+
+        // what the proc:: specs show, looked up once per process
+        struct process_identity {
+            int pid{0};
+            std::string hostname{};
+            std::string program_name{};
+        };
+
+        inline process_identity lookup_process_identity()
+        {
+            process_identity id;
+#ifdef HYX_HAS_POSIX_PROCESS
+            id.pid = static_cast<int>(::getpid());
+
+            std::array<char, 256> host{};
+            if (::gethostname(host.data(), host.size() - 1) == 0) {
+                id.hostname = host.data();
+            }
+
+#if defined(__GLIBC__)
+            id.program_name = program_invocation_short_name;
+#elif defined(__APPLE__) || defined(__FreeBSD__) || defined(__NetBSD__) || defined(__OpenBSD__)
+            id.program_name = ::getprogname();
+#endif
+#endif
+            return id;
+        }
+
+        inline process_identity& current_process()
+        {
+            static process_identity id{lookup_process_identity()};
+            return id;
+        }
+    } // namespace detail
+
+    // what a logger does at construction when its header shows cl::utc, cl::tai, cl::gps or cl::local
+    enum class tzdb_preload {
+        // load on the first record that needs it
+        none,
+        // load before the constructor returns (errors loading the tzdb are thrown from it)
+        synchronous,
+        // load on a thread of the logger's own, which its destructor joins
+        background
+    };
+
+    namespace detail {
+        inline constinit std::atomic<tzdb_preload> tzdb_preload_mode{tzdb_preload::synchronous};
+    } // namespace detail
+
+    // applies to loggers constructed afterwards
+    inline void set_tzdb_preload(tzdb_preload mode) noexcept
+    {
+        detail::tzdb_preload_mode.store(mode, std::memory_order_relaxed);
+    }
+
+    class header_plan;
+
+    namespace detail {
+        // the plans showing proc:: specs, so a forked child can re-render them before anything logs
+        struct process_plan_registry {
+            std::mutex mutex;
+            std::vector<const header_plan*> plans;
+        };
+
+        inline process_plan_registry& process_plans();
+    } // namespace detail
+
+    // a header split into its pieces once, so writing a record only fills in the per-record specs;
+    // proc:: specs are rendered when the plan is built and again in the child after a fork
+    class header_plan {
+    public:
+        // not copyable or movable
+        explicit header_plan(const header_plan&) = delete;
+        explicit header_plan(header_plan&&) = delete;
+        header_plan& operator=(const header_plan&) = delete;
+        header_plan& operator=(header_plan&&) = delete;
+
+        explicit header_plan(std::string_view header)
+        {
+            for (auto& seg : header_layout(header)) {
+                step st{seg.spec};
+                if (!seg.spec) {
+                    st.text = std::move(seg.text);
+                }
+                else if (is_fixed_point(*seg.spec)) {
+                    st.digits = detail::fixed_point_digits(seg.text);
+                }
+                else {
+                    if (detail::is_wall_clock(*seg.spec)) {
+                        st.fast = detail::fast_timestamp_layout(seg.text);
+                    }
+                    st.format = "{:"s.append(seg.text).append("}");
+                }
+
+                has_process_specs_ = has_process_specs_ || (seg.spec && is_process(*seg.spec));
+                steps_.push_back(std::move(st));
+            }
+
+            if (has_process_specs_) {
+                auto& reg = detail::process_plans();
+                const std::lock_guard lock{reg.mutex};
+                render_process_specs();
+                reg.plans.push_back(this);
+            }
+        }
+
+        ~header_plan()
+        {
+            if (has_process_specs_) {
+                auto& reg = detail::process_plans();
+                const std::lock_guard lock{reg.mutex};
+                std::erase(reg.plans, this);
+            }
+        }
+
+        [[nodiscard]] bool uses(detail::spec_id id) const noexcept
+        {
+            return std::ranges::any_of(steps_, [id](const auto& st) { return st.spec == id; });
+        }
+
+        // writes the header for one record
+        template<typename OutIt>
+            requires(std::output_iterator<OutIt, const char&>)
+        OutIt render(OutIt out, std::string_view level, const std::source_location& loc, std::chrono::system_clock::time_point now) const
+        {
+            // monotonic readings are only taken when the header asks for them, and at most once
+            std::optional<std::chrono::steady_clock::time_point> steady_now;
+            std::optional<std::chrono::nanoseconds> elapsed;
+            const auto read_steady = [&] {
+                if (!steady_now) {
+                    steady_now = std::chrono::steady_clock::now();
+                }
+                return *steady_now;
+            };
+            const auto since_last_record = [&] {
+                if (!elapsed) {
+                    const auto prev = std::exchange(detail::last_record_time, read_steady());
+                    elapsed = prev == std::chrono::steady_clock::time_point{} ? std::chrono::nanoseconds{0} : read_steady() - prev;
+                }
+                return *elapsed;
+            };
+
+            for (const auto& st : steps_) {
+                if (!st.spec) {
+                    out = std::ranges::copy(st.text, out).out;
+                    continue;
+                }
+
+                // every clock is derived from the one time point taken for the record, so a
+                // header showing several clocks reads the clock once and shows a single instant
+                switch (*st.spec) {
+                    using enum detail::spec_id;
+                case lvl:
+                    out = std::vformat_to(out, st.format, std::make_format_args(level));
+                    break;
+                case sys:
+                    if (st.fast) {
+                        out = render_fast(out, *st.fast, now.time_since_epoch(), now.time_since_epoch());
+                    }
+                    else {
+                        out = std::vformat_to(out, st.format, std::make_format_args(now));
+                    }
+                    break;
+                case utc: {
+                    // a time point taken from the system clock is never inside a leap second,
+                    // so its civil time is the same as sys
+                    const auto t = std::chrono::clock_cast<std::chrono::utc_clock>(now);
+                    if (st.fast) {
+                        out = render_fast(out, *st.fast, now.time_since_epoch(), t.time_since_epoch());
+                    }
+                    else {
+                        out = std::vformat_to(out, st.format, std::make_format_args(t));
+                    }
+                    break;
+                }
+                case tai: {
+                    // chrono shows tai (and gps) as the civil time that many seconds after their epoch
+                    const auto t = std::chrono::clock_cast<std::chrono::tai_clock>(now);
+                    if (st.fast) {
+                        out = render_fast(out, *st.fast, t.time_since_epoch() - std::chrono::seconds{378691210}, t.time_since_epoch());
+                    }
+                    else {
+                        out = std::vformat_to(out, st.format, std::make_format_args(t));
+                    }
+                    break;
+                }
+                case gps: {
+                    const auto t = std::chrono::clock_cast<std::chrono::gps_clock>(now);
+                    if (st.fast) {
+                        out = render_fast(out, *st.fast, t.time_since_epoch() + std::chrono::seconds{315964809}, t.time_since_epoch());
+                    }
+                    else {
+                        out = std::vformat_to(out, st.format, std::make_format_args(t));
+                    }
+                    break;
+                }
+                case file: {
+                    const auto t = std::chrono::clock_cast<std::chrono::file_clock>(now);
+                    if (st.fast) {
+                        out = render_fast(out, *st.fast, now.time_since_epoch(), t.time_since_epoch());
+                    }
+                    else {
+                        out = std::vformat_to(out, st.format, std::make_format_args(t));
+                    }
+                    break;
+                }
+                case local: {
+                    // this is what formatting a zoned_time does, minus the lookup
+                    const auto& info = detail::local_zone_info(now);
+                    const std::chrono::local_time<std::chrono::system_clock::duration> lt{now.time_since_epoch() + info.offset};
+                    if (st.fast) {
+                        out = render_fast(out, *st.fast, lt.time_since_epoch(), lt.time_since_epoch());
+                    }
+                    else {
+                        const auto t = std::chrono::local_time_format(lt, &info.abbrev, &info.offset);
+                        out = std::vformat_to(out, st.format, std::make_format_args(t));
+                    }
+                    break;
+                }
+                case steady:
+                    out = detail::format_fixed_point(out, read_steady().time_since_epoch(), st.digits);
+                    break;
+                case uptime:
+                    out = detail::format_fixed_point(out, read_steady() - detail::process_start, st.digits);
+                    break;
+                case delta:
+                    out = detail::format_fixed_point(out, since_last_record(), st.digits);
+                    break;
+                case line: {
+                    const auto v = loc.line();
+                    out = std::vformat_to(out, st.format, std::make_format_args(v));
+                    break;
+                }
+                case column: {
+                    const auto v = loc.column();
+                    out = std::vformat_to(out, st.format, std::make_format_args(v));
+                    break;
+                }
+                case file_name: {
+                    const auto* v = loc.file_name();
+                    out = std::vformat_to(out, st.format, std::make_format_args(v));
+                    break;
+                }
+                case function_name: {
+                    const auto* v = loc.function_name();
+                    out = std::vformat_to(out, st.format, std::make_format_args(v));
+                    break;
+                }
+                case pid:
+                    // same as below
+                case hostname:
+                    // same as below
+                case program_name:
+                    out = std::ranges::copy(st.text, out).out;
+                    break;
+                }
+            }
+
+            return out;
+        }
+
+    private:
+        struct step {
+            std::optional<detail::spec_id> spec;
+            std::string format{};
+            int digits{0};
+
+            // set for timestamp layouts that skip the chrono formatter
+            std::optional<detail::fast_timestamp> fast{};
+
+            // literal text, or the rendered value of a proc:: spec; mutable as the latter is rewritten
+            // after a fork, in the (still single-threaded) child, of plans that are otherwise const
+            mutable std::string text{};
+        };
+
+        // civil is the date and time shown by iso layouts, since_epoch the count shown by epoch layouts
+        template<typename OutIt>
+        static OutIt render_fast(OutIt out, const detail::fast_timestamp& ts, std::chrono::nanoseconds civil, std::chrono::nanoseconds since_epoch)
+        {
+            return ts.epoch ? detail::format_fixed_point(out, since_epoch, ts.digits) : detail::format_iso_timestamp(out, civil, ts.separator, ts.digits);
+        }
+
+        static constexpr bool is_fixed_point(detail::spec_id id) noexcept
+        {
+            return id == detail::spec_id::steady || id == detail::spec_id::uptime || id == detail::spec_id::delta;
+        }
+
+        static constexpr bool is_process(detail::spec_id id) noexcept
+        {
+            return id == detail::spec_id::pid || id == detail::spec_id::hostname || id == detail::spec_id::program_name;
+        }
+
+        void render_process_specs() const
+        {
+            const auto& proc = detail::current_process();
+            for (const auto& st : steps_) {
+                if (!st.spec || !is_process(*st.spec)) {
+                    continue;
+                }
+
+                switch (*st.spec) {
+                    using enum detail::spec_id;
+                case pid:
+                    st.text = std::vformat(st.format, std::make_format_args(proc.pid));
+                    break;
+                case hostname:
+                    st.text = std::vformat(st.format, std::make_format_args(proc.hostname));
+                    break;
+                default:
+                    st.text = std::vformat(st.format, std::make_format_args(proc.program_name));
+                    break;
+                }
+            }
+        }
+
+        friend detail::process_plan_registry& detail::process_plans();
+
+        std::vector<step> steps_;
+        bool has_process_specs_{false};
+    };
+
+    namespace detail {
+        inline process_plan_registry& process_plans()
+        {
+            static process_plan_registry reg = [] {
+#ifdef HYX_HAS_POSIX_PROCESS
+                // the registry is held across fork so the child gets it in a consistent state;
+                // the child, still single-threaded, then re-renders what changed with the pid
+                ::pthread_atfork([] { process_plans().mutex.lock(); }, [] { process_plans().mutex.unlock(); },
+                                 [] {
+                                     auto& r = process_plans();
+                                     current_process().pid = static_cast<int>(::getpid());
+                                     for (auto* plan : r.plans) {
+                                         plan->render_process_specs();
+                                     }
+                                     r.mutex.unlock();
+                                 });
+#endif
+                return process_plan_registry{};
+            }();
+
+            return reg;
+        }
+    } // namespace detail
+} // namespace hyx
+
+#endif // !HYX_HEADER_PLAN_H
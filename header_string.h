@@ -14,6 +14,9 @@
 // You should have received a copy of the GNU General Public License
 // along with this program. If not, see <http://www.gnu.org/licenses/>.
 
+#ifndef HYX_HEADER_STRING_H
+#define HYX_HEADER_STRING_H
+
 #include <algorithm>
 #include <chrono>
 #include <concepts>
@@ -21,10 +24,13 @@
 #include <hyx/type_sequence.h>
 #include <iostream>
 #include <iterator>
+#include <optional>
 #include <ranges>
+#include <string>
 #include <string_view>
 #include <type_traits>
 #include <utility>
+#include <vector>
 
 // in the following code, comments will use these shorthands:
 // (! == not previous ;; ? == wildcard, including previous ;; ... == context)
@@ -137,12 +143,21 @@ namespace hyx {
             tai,
             gps,
             file,
+            local,
+            steady,
+            uptime,
+            delta,
 
             // source
             line,
             column,
             file_name,
-            function_name
+            function_name,
+
+            // process
+            pid,
+            hostname,
+            program_name
         };
 
         struct global_namespace : public std::string_view {
@@ -188,8 +203,114 @@ namespace hyx {
 
                 constinit static const auto id{spec_id::file};
             };
+
+            // wall-clock time in the current time zone, formatted like a zoned_time
+            struct local : public std::string_view {
+                consteval local() : std::string_view("local") {}
+
+                constinit static const auto id{spec_id::local};
+            };
+
+            // the monotonic clocks render as fixed-point seconds
+
+            struct steady : public std::string_view {
+                consteval steady() : std::string_view("steady") {}
+
+                constinit static const auto id{spec_id::steady};
+            };
+
+            struct uptime : public std::string_view {
+                consteval uptime() : std::string_view("uptime") {}
+
+                constinit static const auto id{spec_id::uptime};
+            };
+
+            struct delta : public std::string_view {
+                consteval delta() : std::string_view("delta") {}
+
+                constinit static const auto id{spec_id::delta};
+            };
         } // namespace cl
 
+        // the spec of a fixed-point clock is empty or the number of fractional digits (0-9)
+        constexpr int fixed_point_digits(std::string_view spec)
+        {
+            if (spec.empty()) {
+                return 6;
+            }
+
+            if (spec.size() != 1 || spec.front() < '0' || spec.front() > '9') {
+                _throw_format_error("format error: fixed-point clock spec must be a single digit");
+            }
+
+            return spec.front() - '0';
+        }
+
+        // timestamp layouts the logger writes itself rather than through the chrono formatter:
+        //   isoN     2024-05-01T12:34:56.789 with N (0-9) fractional digits, none if left out
+        //   epochN   1714566896.789 (seconds since the clock's epoch) with N fractional digits, 6 if left out
+        // %FT%T and %F %T are also recognized, and written exactly as chrono would
+        struct fast_timestamp {
+            bool epoch{false};
+            char separator{'T'};
+            int digits{0};
+        };
+
+        // the fractional digits chrono shows for the logger's time points, or -1 if they aren't decimal
+        consteval int clock_fraction_digits()
+        {
+            using period = std::chrono::system_clock::period;
+            if (period::num != 1) {
+                return -1;
+            }
+
+            int digits = 0;
+            for (auto den = period::den; den > 1; den /= 10) {
+                if (den % 10 != 0) {
+                    return -1;
+                }
+                ++digits;
+            }
+
+            return digits <= 9 ? digits : -1;
+        }
+
+        constexpr std::optional<fast_timestamp> fast_timestamp_layout(std::string_view spec) noexcept
+        {
+            constexpr int chrono_digits = clock_fraction_digits();
+            if (chrono_digits >= 0) {
+                if (spec == "%FT%T" || spec == "%Y-%m-%dT%H:%M:%S") {
+                    return fast_timestamp{false, 'T', chrono_digits};
+                }
+                if (spec == "%F %T" || spec == "%Y-%m-%d %H:%M:%S") {
+                    return fast_timestamp{false, ' ', chrono_digits};
+                }
+            }
+
+            for (const bool epoch : {false, true}) {
+                const auto keyword = epoch ? "epoch"sv : "iso"sv;
+                if (!spec.starts_with(keyword)) {
+                    continue;
+                }
+
+                spec.remove_prefix(keyword.size());
+                if (spec.empty()) {
+                    return fast_timestamp{epoch, 'T', epoch ? 6 : 0};
+                }
+                if (spec.size() == 1 && spec.front() >= '0' && spec.front() <= '9') {
+                    return fast_timestamp{epoch, 'T', spec.front() - '0'};
+                }
+                return std::nullopt;
+            }
+
+            return std::nullopt;
+        }
+
+        constexpr bool is_wall_clock(spec_id id) noexcept
+        {
+            return id == spec_id::sys || id == spec_id::utc || id == spec_id::tai || id == spec_id::gps || id == spec_id::file || id == spec_id::local;
+        }
+
         struct source_namespace : public std::string_view {
             consteval source_namespace() : std::string_view("sl::") {}
         };
@@ -218,6 +339,30 @@ namespace hyx {
                 constinit static const auto id{spec_id::function_name};
             };
         } // namespace sl
+
+        // process values are looked up once and reused by every record (see <hyx/header_plan.h>)
+        struct process_namespace : public std::string_view {
+            consteval process_namespace() : std::string_view("proc::") {}
+        };
+        namespace proc {
+            struct pid : public std::string_view {
+                consteval pid() : std::string_view("pid") {}
+
+                constinit static const auto id{spec_id::pid};
+            };
+
+            struct hostname : public std::string_view {
+                consteval hostname() : std::string_view("hostname") {}
+
+                constinit static const auto id{spec_id::hostname};
+            };
+
+            struct program_name : public std::string_view {
+                consteval program_name() : std::string_view("program_name") {}
+
+                constinit static const auto id{spec_id::program_name};
+            };
+        } // namespace proc
     }     // namespace detail
 
     struct basic_scanner {
@@ -225,9 +370,10 @@ namespace hyx {
         using iterator = typename std::string_view::iterator;
 
         using GlobalSpecs = std::pair<detail::global_namespace, hyx::meta::type_sequence<detail::lvl>>;
-        using ClockSpecs = std::pair<detail::clock_namespace, hyx::meta::type_sequence<detail::cl::sys, detail::cl::utc, detail::cl::tai, detail::cl::gps, detail::cl::file>>;
+        using ClockSpecs = std::pair<detail::clock_namespace, hyx::meta::type_sequence<detail::cl::sys, detail::cl::utc, detail::cl::tai, detail::cl::gps, detail::cl::file, detail::cl::local, detail::cl::steady, detail::cl::uptime, detail::cl::delta>>;
         using SourceSpecs = std::pair<detail::source_namespace, hyx::meta::type_sequence<detail::sl::line, detail::sl::column, detail::sl::file_name, detail::sl::function_name>>;
-        using AvailableSpecs = hyx::meta::type_sequence<GlobalSpecs, ClockSpecs, SourceSpecs>;
+        using ProcessSpecs = std::pair<detail::process_namespace, hyx::meta::type_sequence<detail::proc::pid, detail::proc::hostname, detail::proc::program_name>>;
+        using AvailableSpecs = hyx::meta::type_sequence<GlobalSpecs, ClockSpecs, SourceSpecs, ProcessSpecs>;
 
         constexpr explicit basic_scanner(std::string_view str) : ctx_(str) {}
 
@@ -344,6 +490,11 @@ namespace hyx {
         {
             std::format_parse_context pc{{ctx_.begin(), ctx_.subend()}};
 
+            // the logger writes these itself, so they don't have to be chrono specs
+            if (detail::is_wall_clock(id) && detail::fast_timestamp_layout({ctx_.begin(), ctx_.subend()})) {
+                return;
+            }
+
             switch (id) {
             case detail::spec_id::sys:
                 std::formatter<std::chrono::time_point<std::chrono::system_clock>>{}.parse(pc);
@@ -360,23 +511,76 @@ namespace hyx {
             case detail::spec_id::file:
                 std::formatter<std::chrono::time_point<std::chrono::file_clock>>{}.parse(pc);
                 break;
+            case detail::spec_id::local:
+                std::formatter<decltype(std::chrono::local_time_format(std::declval<std::chrono::local_time<std::chrono::system_clock::duration>>()))>{}.parse(pc);
+                break;
+            case detail::spec_id::steady:
+                // same as below
+            case detail::spec_id::uptime:
+                // same as below
+            case detail::spec_id::delta:
+                detail::fixed_point_digits({ctx_.begin(), ctx_.subend()});
+                break;
             case detail::spec_id::line:
                 // same as below
             case detail::spec_id::column:
                 // uint_least32_t as defined by the standard for line and column
                 std::formatter<std::uint_least32_t>{}.parse(pc);
                 break;
+            case detail::spec_id::pid:
+                std::formatter<int>{}.parse(pc);
+                break;
             case detail::spec_id::lvl:
                 // same as below
             case detail::spec_id::file_name:
                 // same as below
             case detail::spec_id::function_name:
+                // same as below
+            case detail::spec_id::hostname:
+                // same as below
+            case detail::spec_id::program_name:
                 std::formatter<std::string>{}.parse(pc);
                 break;
             }
         }
     };
 
+    // one piece of a header: literal text or a spec (holding its format spec)
+    struct header_segment {
+        std::optional<detail::spec_id> spec;
+        std::string text;
+    };
+
+    // splits a header into literal and spec segments using the same grammar as the other scanners
+    class layout_scanner : public basic_scanner {
+    public:
+        explicit layout_scanner(std::string_view fmt) : basic_scanner(fmt) {}
+
+        std::vector<header_segment> segments;
+
+    private:
+        void on_event(iterator end) override
+        {
+            std::string literal;
+            std::unique_copy(begin(), end, std::back_inserter(literal), [](auto a, auto b) { return (a == '[' && b == '[') || (a == ']' && b == ']'); });
+            if (!literal.empty()) {
+                segments.push_back({std::nullopt, std::move(literal)});
+            }
+        }
+
+        void consume_spec(detail::spec_id id) override
+        {
+            segments.push_back({id, std::string{ctx_.begin(), ctx_.subend()}});
+        }
+    };
+
+    inline std::vector<header_segment> header_layout(std::string_view header)
+    {
+        layout_scanner ls{header};
+        ls.scan();
+        return std::move(ls.segments);
+    }
+
     template<typename... Args>
     class header_string : public std::format_string<Args...> {
     public:
@@ -389,3 +593,5 @@ namespace hyx {
         }
     };
 } // namespace hyx
+
+#endif // !HYX_HEADER_STRING_H
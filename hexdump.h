@@ -0,0 +1,222 @@
+// <hyx/hexdump.h> -*- C++ -*-
+// Copyright (C) 2023 Michael Pollak
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef HYX_HEXDUMP_H
+#define HYX_HEXDUMP_H
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <format>
+#include <ranges>
+#include <span>
+#include <string_view>
+#include <type_traits>
+
+// the ssse3 loop is compiled for its own target and picked at run time, so default x86-64 builds get it too
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define HYX_HEXDUMP_SSSE3 1
+#include <immintrin.h>
+#endif
+
+namespace hyx {
+    struct hexdump_options {
+        // start each line with the offset of its first byte
+        bool offsets{false};
+        // end each line with its printable bytes
+        bool ascii{false};
+        // bytes past this are counted instead of shown
+        std::size_t max_bytes{4096};
+    };
+
+    // formats bytes as one run of hex digits, or as `hexdump -C` style lines of 16 bytes when
+    // an offset or ascii column is asked for (it only views the bytes, so pass it straight to the logger)
+    class hexdump {
+    public:
+        template<std::ranges::contiguous_range R>
+            requires(std::ranges::sized_range<R> && sizeof(std::ranges::range_value_t<R>) == 1 && std::is_trivially_copyable_v<std::ranges::range_value_t<R>>)
+        explicit hexdump(const R& bytes, hexdump_options opts = {}) noexcept : bytes_(reinterpret_cast<const std::byte*>(std::ranges::data(bytes)), std::ranges::size(bytes)), opts_(opts)
+        {
+        }
+
+        [[nodiscard]] std::span<const std::byte> bytes() const noexcept
+        {
+            return bytes_;
+        }
+
+        [[nodiscard]] const hexdump_options& options() const noexcept
+        {
+            return opts_;
+        }
+
+    private:
+        std::span<const std::byte> bytes_;
+        hexdump_options opts_;
+    };
+
+    namespace detail {
+        inline constexpr std::string_view hex_digits{"0123456789abcdef"};
+
+#ifdef HYX_HEXDUMP_SSSE3
+        inline bool has_ssse3() noexcept
+        {
+#ifdef __SSSE3__
+            return true;
+#else
+            static const bool supported = [] {
+                __builtin_cpu_init();
+                return __builtin_cpu_supports("ssse3") != 0;
+            }();
+            return supported;
+#endif
+        }
+
+        // encodes the whole sixteen-byte blocks of [in, in + n) and returns how many bytes that was;
+        // each nibble indexes the digit table with one byte shuffle
+        [[gnu::target("ssse3")]] inline std::size_t hex_encode_ssse3(char* out, const std::byte* in, std::size_t n) noexcept
+        {
+            const auto digits = _mm_setr_epi8('0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f');
+            const auto low_nibble = _mm_set1_epi8(0x0f);
+            std::size_t done = 0;
+            for (; n - done >= 16; done += 16) {
+                const auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + done));
+                const auto hi = _mm_shuffle_epi8(digits, _mm_and_si128(_mm_srli_epi16(v, 4), low_nibble));
+                const auto lo = _mm_shuffle_epi8(digits, _mm_and_si128(v, low_nibble));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 2 * done), _mm_unpacklo_epi8(hi, lo));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 2 * done + 16), _mm_unpackhi_epi8(hi, lo));
+            }
+
+            return done;
+        }
+#endif
+
+        // writes two hex digits per byte, sixteen bytes at a time where the cpu has ssse3
+        inline char* hex_encode(char* out, const std::byte* in, std::size_t n) noexcept
+        {
+#ifdef HYX_HEXDUMP_SSSE3
+            if (n >= 16 && has_ssse3()) {
+                const auto done = hex_encode_ssse3(out, in, n);
+                out += 2 * done;
+                in += done;
+                n -= done;
+            }
+#endif
+            for (; n != 0; --n, ++in) {
+                const auto b = static_cast<unsigned char>(*in);
+                *out++ = hex_digits[b >> 4];
+                *out++ = hex_digits[b & 0x0f];
+            }
+
+            return out;
+        }
+
+        // one `hexdump -C` line: offset, two groups of eight bytes, then the printable bytes
+        inline char* hexdump_line(char* out, std::size_t offset, std::span<const std::byte> line, const hexdump_options& opts) noexcept
+        {
+            if (opts.offsets) {
+                for (int shift = 28; shift >= 0; shift -= 4) {
+                    *out++ = hex_digits[(offset >> shift) & 0x0f];
+                }
+                *out++ = ' ';
+                *out++ = ' ';
+            }
+
+            std::array<char, 32> hex;
+            hex_encode(hex.data(), line.data(), line.size());
+            for (std::size_t i = 0; i < 16; ++i) {
+                if (i < line.size()) {
+                    *out++ = hex[2 * i];
+                    *out++ = hex[2 * i + 1];
+                }
+                else {
+                    // keep the ascii column aligned on a short last line
+                    *out++ = ' ';
+                    *out++ = ' ';
+                }
+                *out++ = ' ';
+                if (i == 7) {
+                    *out++ = ' ';
+                }
+            }
+
+            if (opts.ascii) {
+                *out++ = ' ';
+                *out++ = '|';
+                for (const auto b : line) {
+                    const auto c = static_cast<unsigned char>(b);
+                    *out++ = c >= 0x20 && c < 0x7f ? static_cast<char>(c) : '.';
+                }
+                *out++ = '|';
+            }
+            else {
+                // drop the padding after the last group
+                while (out[-1] == ' ') {
+                    --out;
+                }
+            }
+
+            return out;
+        }
+    } // namespace detail
+} // namespace hyx
+
+template<>
+struct std::formatter<hyx::hexdump, char> {
+    constexpr auto parse(std::format_parse_context& pc)
+    {
+        const auto it = pc.begin();
+        if (it != pc.end() && *it != '}') {
+            throw std::format_error("format error: hexdump takes no format spec");
+        }
+        return it;
+    }
+
+    template<typename FormatContext>
+    auto format(const hyx::hexdump& hd, FormatContext& ctx) const
+    {
+        const auto& opts = hd.options();
+        const auto all = hd.bytes();
+        const auto shown = all.first(std::min(all.size(), opts.max_bytes));
+        auto out = ctx.out();
+
+        if (!opts.offsets && !opts.ascii) {
+            // encoded a chunk at a time through a small stack buffer
+            std::array<char, 512> buf;
+            for (std::size_t pos = 0; pos < shown.size(); pos += buf.size() / 2) {
+                const auto chunk = shown.subspan(pos, std::min(buf.size() / 2, shown.size() - pos));
+                out = std::ranges::copy(buf.data(), hyx::detail::hex_encode(buf.data(), chunk.data(), chunk.size()), out).out;
+            }
+        }
+        else {
+            std::array<char, 96> buf;
+            for (std::size_t pos = 0; pos < shown.size(); pos += 16) {
+                if (pos != 0) {
+                    *out++ = '\n';
+                }
+                out = std::ranges::copy(buf.data(), hyx::detail::hexdump_line(buf.data(), pos, shown.subspan(pos, std::min<std::size_t>(16, shown.size() - pos)), opts), out).out;
+            }
+        }
+
+        if (shown.size() != all.size()) {
+            const auto* sep = shown.empty() ? "" : !opts.offsets && !opts.ascii ? " " : "\n";
+            out = std::format_to(out, "{}... ({} more bytes)", sep, all.size() - shown.size());
+        }
+
+        return out;
+    }
+};
+
+#endif // !HYX_HEXDUMP_H
@@ -0,0 +1,539 @@
+// <hyx/log_parser.h> -*- C++ -*-
+// Copyright (C) 2023 Michael Pollak
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef HYX_LOG_PARSER_H
+#define HYX_LOG_PARSER_H
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <concepts>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <hyx/header_string.h>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace hyx {
+    // the fields of one line, all viewing into the parsed text
+    struct log_record {
+        std::string_view level{};
+
+        // raw timestamp text, see log_parser::time()
+        std::string_view sys{};
+        std::string_view utc{};
+        std::string_view tai{};
+        std::string_view gps{};
+        std::string_view file{};
+        std::string_view local{};
+        std::string_view steady{};
+        std::string_view uptime{};
+        std::string_view delta{};
+
+        std::uint_least32_t line{0};
+        std::uint_least32_t column{0};
+        std::string_view file_name{};
+        std::string_view function_name{};
+
+        int pid{0};
+        std::string_view hostname{};
+        std::string_view program_name{};
+
+        std::string_view message{};
+    };
+
+    struct parse_stats {
+        std::size_t records{0};
+        std::size_t malformed{0};
+    };
+
+    namespace detail {
+        // memchr is vectorized by the c library, so searching on the first byte is the fast part
+        inline std::size_t find_delimiter(std::string_view str, std::string_view delim, std::size_t from) noexcept
+        {
+            while (from + delim.size() <= str.size()) {
+                const auto* hit = static_cast<const char*>(std::memchr(str.data() + from, delim.front(), str.size() - from));
+                if (hit == nullptr) {
+                    break;
+                }
+
+                from = static_cast<std::size_t>(hit - str.data());
+                if (str.substr(from).starts_with(delim)) {
+                    return from;
+                }
+                ++from;
+            }
+
+            return std::string_view::npos;
+        }
+
+        template<typename Clock>
+        std::optional<std::chrono::sys_time<std::chrono::nanoseconds>> parse_clock(std::string_view text, const std::string& fmt)
+        {
+            std::istringstream in{std::string{text}};
+            std::chrono::time_point<Clock, std::chrono::nanoseconds> tp;
+            std::chrono::from_stream(in, fmt.c_str(), tp);
+            if (in.fail()) {
+                return std::nullopt;
+            }
+
+            if constexpr (std::is_same_v<Clock, std::chrono::system_clock>) {
+                return tp;
+            }
+            else {
+                return std::chrono::clock_cast<std::chrono::system_clock>(tp);
+            }
+        }
+
+        // local times carry their offset when the header shows %z, otherwise the current zone is assumed
+        inline std::optional<std::chrono::sys_time<std::chrono::nanoseconds>> parse_local(std::string_view text, const std::string& fmt)
+        {
+            std::istringstream in{std::string{text}};
+            std::chrono::local_time<std::chrono::nanoseconds> tp;
+            std::string abbrev;
+            std::chrono::minutes offset{0};
+            const bool has_offset = fmt.contains("%z");
+            std::chrono::from_stream(in, fmt.c_str(), tp, &abbrev, has_offset ? &offset : nullptr);
+            if (in.fail()) {
+                return std::nullopt;
+            }
+
+            if (has_offset) {
+                return std::chrono::sys_time<std::chrono::nanoseconds>{tp.time_since_epoch() - offset};
+            }
+            return std::chrono::current_zone()->to_sys(tp);
+        }
+    } // namespace detail
+
+    // reads lines written by a logger back into fields, given the header that logger used
+    class log_parser {
+    public:
+        template<typename... Args>
+        explicit log_parser(const header_string<std::type_identity_t<Args>...> fmt = "", Args&&... args) : segments_(header_layout(std::format(fmt, std::forward<Args>(args)...)))
+        {
+            skips_.reserve(segments_.size());
+            for (std::size_t i = 0; i < segments_.size(); ++i) {
+                skips_.push_back(i + 1 < segments_.size() && !segments_[i + 1].spec ? delimiter_skips(segments_[i], segments_[i + 1].text) : 0);
+            }
+        }
+
+        // fills rec from one line (without its newline) and returns false if it doesn't fit the header
+        bool parse(std::string_view line, log_record& rec) const
+        {
+            std::size_t pos = 0;
+            for (std::size_t i = 0; i < segments_.size(); ++i) {
+                const auto& seg = segments_[i];
+                if (!seg.spec) {
+                    if (!line.substr(pos).starts_with(seg.text)) {
+                        return false;
+                    }
+                    pos += seg.text.size();
+                    continue;
+                }
+
+                // a field runs up to the following literal, or to the next space when there is none
+                std::size_t end;
+                if (i + 1 < segments_.size() && !segments_[i + 1].spec) {
+                    const std::string_view delim{segments_[i + 1].text};
+                    end = pos;
+                    for (auto skip = skips_[i];; --skip) {
+                        end = detail::find_delimiter(line, delim, end);
+                        if (end == std::string_view::npos) {
+                            return false;
+                        }
+                        if (skip == 0) {
+                            break;
+                        }
+                        end += delim.size();
+                    }
+                }
+                else {
+                    end = std::min(line.find(' ', pos), line.size());
+                }
+
+                if (!assign(rec, *seg.spec, line.substr(pos, end - pos))) {
+                    return false;
+                }
+                pos = end;
+            }
+
+            rec.message = line.substr(pos);
+            return true;
+        }
+
+        // parses the first timestamp in the header into system time
+        std::optional<std::chrono::sys_time<std::chrono::nanoseconds>> time(const log_record& rec) const
+        {
+            for (const auto& seg : segments_) {
+                if (!seg.spec || !detail::is_wall_clock(*seg.spec)) {
+                    continue;
+                }
+
+                const auto fast = detail::fast_timestamp_layout(seg.text);
+                if (fast && fast->epoch) {
+                    return epoch_time(rec, *seg.spec);
+                }
+
+                const auto fmt = fast ? "%Y-%m-%d"s.append(1, fast->separator).append("%H:%M:%S") : chrono_format(seg.text);
+                switch (*seg.spec) {
+                    using enum detail::spec_id;
+                case sys:
+                    return detail::parse_clock<std::chrono::system_clock>(rec.sys, fmt);
+                case utc:
+                    return detail::parse_clock<std::chrono::utc_clock>(rec.utc, fmt);
+                case tai:
+                    return detail::parse_clock<std::chrono::tai_clock>(rec.tai, fmt);
+                case gps:
+                    return detail::parse_clock<std::chrono::gps_clock>(rec.gps, fmt);
+                case file:
+                    return detail::parse_clock<std::chrono::file_clock>(rec.file, fmt);
+                case local:
+                    return detail::parse_local(rec.local, fmt);
+                default:
+                    break;
+                }
+            }
+
+            return std::nullopt;
+        }
+
+        // parses every line of a file, splitting it into one chunk per thread;
+        // f is called concurrently from those threads
+        template<typename F>
+            requires std::invocable<F&, const log_record&>
+        parse_stats for_each_record(const std::filesystem::path& path, F&& f, unsigned threads = std::thread::hardware_concurrency()) const
+        {
+            const auto size = std::filesystem::file_size(path);
+            threads = static_cast<unsigned>(std::clamp<std::uintmax_t>(size / min_chunk_size, 1, std::max(threads, 1u)));
+
+            std::vector<parse_stats> stats(threads);
+            std::vector<std::exception_ptr> errors(threads);
+            {
+                std::vector<std::jthread> workers;
+                workers.reserve(threads);
+                for (unsigned k = 0; k < threads; ++k) {
+                    workers.emplace_back([&, k] {
+                        try {
+                            stats[k] = parse_chunk(path, size * k / threads, size * (k + 1) / threads, f);
+                        }
+                        catch (...) {
+                            errors[k] = std::current_exception();
+                        }
+                    });
+                }
+            }
+
+            parse_stats total;
+            for (unsigned k = 0; k < threads; ++k) {
+                if (errors[k]) {
+                    std::rethrow_exception(errors[k]);
+                }
+                total.records += stats[k].records;
+                total.malformed += stats[k].malformed;
+            }
+
+            return total;
+        }
+
+    private:
+        static constexpr std::uintmax_t min_chunk_size{1024 * 1024};
+        static constexpr std::size_t read_size{1024 * 1024};
+
+        // chrono specs may start with fill, alignment and width; from_stream only wants the conversions
+        static std::string chrono_format(std::string_view spec)
+        {
+            const auto conv = spec.find('%');
+            return std::string{conv == std::string_view::npos ? spec : spec.substr(conv)};
+        }
+
+        // epochN timestamps are seconds since the clock's own epoch
+        static std::optional<std::chrono::sys_time<std::chrono::nanoseconds>> epoch_time(const log_record& rec, detail::spec_id id)
+        {
+            using namespace std::chrono;
+            const auto since = [](std::string_view text) -> std::optional<nanoseconds> {
+                const bool negative = text.starts_with('-');
+                text.remove_prefix(negative ? 1 : 0);
+
+                std::int64_t secs = 0;
+                auto res = std::from_chars(text.data(), text.data() + text.size(), secs);
+                if (res.ec != std::errc{}) {
+                    return std::nullopt;
+                }
+
+                std::int64_t frac = 0;
+                int digits = 0;
+                if (res.ptr != text.data() + text.size() && *res.ptr == '.') {
+                    for (++res.ptr; res.ptr != text.data() + text.size() && *res.ptr >= '0' && *res.ptr <= '9'; ++res.ptr, ++digits) {
+                        if (digits < 9) {
+                            frac = frac * 10 + (*res.ptr - '0');
+                        }
+                    }
+                }
+                for (; digits < 9; ++digits) {
+                    frac *= 10;
+                }
+
+                const nanoseconds d{secs * 1'000'000'000 + frac};
+                return negative ? -d : d;
+            };
+
+            switch (id) {
+                using enum detail::spec_id;
+            case sys:
+                if (const auto d = since(rec.sys)) {
+                    return sys_time<nanoseconds>{*d};
+                }
+                break;
+            case utc:
+                if (const auto d = since(rec.utc)) {
+                    return clock_cast<system_clock>(utc_time<nanoseconds>{*d});
+                }
+                break;
+            case tai:
+                if (const auto d = since(rec.tai)) {
+                    return clock_cast<system_clock>(tai_time<nanoseconds>{*d});
+                }
+                break;
+            case gps:
+                if (const auto d = since(rec.gps)) {
+                    return clock_cast<system_clock>(gps_time<nanoseconds>{*d});
+                }
+                break;
+            case file:
+                if (const auto d = since(rec.file)) {
+                    return clock_cast<system_clock>(file_time<nanoseconds>{*d});
+                }
+                break;
+            case local:
+                if (const auto d = since(rec.local)) {
+                    return current_zone()->to_sys(local_time<nanoseconds>{*d});
+                }
+                break;
+            default:
+                break;
+            }
+
+            return std::nullopt;
+        }
+
+        // how often the delimiter after a field shows up inside that field (e.g., the space in "%F %T")
+        static std::size_t delimiter_skips(const header_segment& field, std::string_view delim)
+        {
+            std::string sample;
+            const auto fast = detail::is_wall_clock(*field.spec) ? detail::fast_timestamp_layout(field.text) : std::nullopt;
+            const auto fmt = std::string{"{:"}.append(field.text).append("}");
+            // (format arguments have to be lvalues)
+            const auto render = [&](const auto& value) {
+                // layouts the logger writes itself look like their zero value
+                if (fast) {
+                    auto zero = fast->epoch ? "0"s : "0000-00-00"s.append(1, fast->separator).append("00:00:00");
+                    if (fast->digits > 0) {
+                        zero.append(1, '.').append(static_cast<std::size_t>(fast->digits), '0');
+                    }
+                    return zero;
+                }
+                return std::vformat(fmt, std::make_format_args(value));
+            };
+
+            switch (*field.spec) {
+                using enum detail::spec_id;
+            case sys:
+                sample = render(std::chrono::system_clock::time_point{});
+                break;
+            case utc:
+                sample = render(std::chrono::utc_clock::time_point{});
+                break;
+            case tai:
+                sample = render(std::chrono::tai_clock::time_point{});
+                break;
+            case gps:
+                sample = render(std::chrono::gps_clock::time_point{});
+                break;
+            case file:
+                sample = render(std::chrono::file_clock::time_point{});
+                break;
+            case local: {
+                const std::string abbrev{"UTC"};
+                const std::chrono::seconds offset{0};
+                sample = render(std::chrono::local_time_format(std::chrono::local_time<std::chrono::system_clock::duration>{}, &abbrev, &offset));
+                break;
+            }
+            default:
+                // levels, numbers and names have no fixed shape to learn from
+                return 0;
+            }
+
+            std::size_t count = 0;
+            for (auto pos = detail::find_delimiter(sample, delim, 0); pos != std::string_view::npos; pos = detail::find_delimiter(sample, delim, pos + delim.size())) {
+                ++count;
+            }
+
+            return count;
+        }
+
+        static bool assign(log_record& rec, detail::spec_id id, std::string_view text)
+        {
+            const auto to_number = [&](auto& out) {
+                // numbers may be padded by their format spec
+                const auto first = text.find_first_not_of(' ');
+                if (first == std::string_view::npos) {
+                    return false;
+                }
+                const auto res = std::from_chars(text.data() + first, text.data() + text.size(), out);
+                return res.ec == std::errc{};
+            };
+
+            switch (id) {
+                using enum detail::spec_id;
+            case lvl:
+                rec.level = text;
+                break;
+            case sys:
+                rec.sys = text;
+                break;
+            case utc:
+                rec.utc = text;
+                break;
+            case tai:
+                rec.tai = text;
+                break;
+            case gps:
+                rec.gps = text;
+                break;
+            case file:
+                rec.file = text;
+                break;
+            case local:
+                rec.local = text;
+                break;
+            case steady:
+                rec.steady = text;
+                break;
+            case uptime:
+                rec.uptime = text;
+                break;
+            case delta:
+                rec.delta = text;
+                break;
+            case line:
+                return to_number(rec.line);
+            case column:
+                return to_number(rec.column);
+            case file_name:
+                rec.file_name = text;
+                break;
+            case function_name:
+                rec.function_name = text;
+                break;
+            case pid:
+                return to_number(rec.pid);
+            case hostname:
+                rec.hostname = text;
+                break;
+            case program_name:
+                rec.program_name = text;
+                break;
+            }
+
+            return true;
+        }
+
+        // handles the lines that start in [begin, end)
+        template<typename F>
+        parse_stats parse_chunk(const std::filesystem::path& path, std::uintmax_t begin, std::uintmax_t end, F& f) const
+        {
+            parse_stats stats;
+            if (begin >= end) {
+                return stats;
+            }
+
+            std::ifstream in(path, std::ios_base::binary);
+            // start one byte early so a line beginning exactly at begin is recognized
+            auto offset = begin == 0 ? 0 : begin - 1;
+            in.seekg(static_cast<std::streamoff>(offset));
+            bool skipping = begin != 0;
+
+            std::string buf;
+            log_record rec;
+            const auto handle = [&](std::string_view line) {
+                if (!line.empty() && line.back() == '\r') {
+                    line.remove_suffix(1);
+                }
+
+                rec = {};
+                if (parse(line, rec)) {
+                    ++stats.records;
+                    f(static_cast<const log_record&>(rec));
+                }
+                else {
+                    ++stats.malformed;
+                }
+            };
+
+            while (true) {
+                const auto kept = buf.size();
+                buf.resize(kept + read_size);
+                in.read(buf.data() + kept, static_cast<std::streamsize>(read_size));
+                buf.resize(kept + static_cast<std::size_t>(in.gcount()));
+                const bool eof = in.gcount() == 0;
+
+                std::string_view rest{buf};
+                for (const char* nl; (nl = static_cast<const char*>(std::memchr(rest.data(), '\n', rest.size()))) != nullptr;) {
+                    const auto len = static_cast<std::size_t>(nl - rest.data());
+                    if (skipping) {
+                        // the tail of a line owned by the previous chunk
+                        skipping = false;
+                    }
+                    else if (offset >= end) {
+                        return stats;
+                    }
+                    else {
+                        handle(rest.substr(0, len));
+                    }
+
+                    offset += len + 1;
+                    rest.remove_prefix(len + 1);
+                }
+
+                if (eof) {
+                    // a final line without a newline
+                    if (!rest.empty() && !skipping && offset < end) {
+                        handle(rest);
+                    }
+                    return stats;
+                }
+
+                buf.erase(0, buf.size() - rest.size());
+            }
+        }
+
+        std::vector<header_segment> segments_;
+        std::vector<std::size_t> skips_;
+    };
+} // namespace hyx
+
+#endif // !HYX_LOG_PARSER_H
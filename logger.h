@@ -18,19 +18,70 @@
 #define HYX_LOGGER_H
 
 #include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <cstdint>
+#include <deque>
 #include <filesystem>
 #include <format>
-#include <fstream>
+#include <functional>
+#include <hyx/header_plan.h>
 #include <hyx/header_string.h>
+#include <hyx/rcu.h>
+#include <hyx/record_slot.h>
+#include <hyx/sink.h>
 #include <iostream>
 #include <iterator>
+#include <memory>
+#include <optional>
 #include <source_location>
+#include <span>
 #include <stdexcept>
 #include <string>
 #include <string_view>
-#include <syncstream>
+#include <thread>
 #include <type_traits>
+#include <utility>
+#include <vector>
+
+// call-site descriptors are registered by placing their address in a dedicated ELF section
+// (the descriptors themselves can't live there: gcc rejects mixing comdat and non-comdat
+// objects in one named section, which inline functions and templates would cause). position
+// independent code can't hand the address to asm as an immediate, so there (and off ELF) each
+// descriptor is instead registered at load time by detail::call_site_registration
+#if defined(__ELF__) && defined(__GNUC__)
+#define HYX_CALL_SITE_SECTION "hyx_call_sites"
+
+namespace hyx {
+    struct call_site;
+}
+
+// defined by the linker for any section whose name is a valid c identifier
+extern "C" {
+[[gnu::weak]] extern hyx::call_site* const __start_hyx_call_sites[];
+[[gnu::weak]] extern hyx::call_site* const __stop_hyx_call_sites[];
+}
+#endif
+
+#if defined(HYX_CALL_SITE_SECTION) && !defined(__PIC__)
+#define HYX_STRINGIFY_IMPL(x) #x
+#define HYX_STRINGIFY(x) HYX_STRINGIFY_IMPL(x)
+#define HYX_REGISTER_CALL_SITE(site)                                                                      \
+    asm(".pushsection " HYX_CALL_SITE_SECTION ",\"aw\"\n\t"                                              \
+        ".balign " HYX_STRINGIFY(__SIZEOF_POINTER__) "\n\t"                                               \
+        ".dc.a %c0\n\t"                                                                                   \
+        ".popsection" ::"i"(&(site)))
+#else
+#define HYX_REGISTER_CALL_SITE(site) static_cast<void>(::hyx::detail::call_site_registration<&(site)>::registered)
+#endif
+
+// logs through `logger` while registering the call site (see hyx::call_sites())
+#define HYX_LOG(logger, lvl, fmt, ...)                                                                    \
+    do {                                                                                                  \
+        static constinit ::hyx::call_site hyx_call_site_{(fmt), (lvl), ::std::source_location::current()}; \
+        HYX_REGISTER_CALL_SITE(hyx_call_site_);                                                           \
+        (logger)(hyx_call_site_, (fmt)__VA_OPT__(, ) __VA_ARGS__);                                        \
+    } while (false)
 
 namespace hyx {
     template<typename... Args>
@@ -47,24 +98,34 @@ namespace hyx {
 
     class log_level {
     public:
-        consteval log_level(const std::string_view lbl) noexcept : label(lbl) {}
+        // custom levels rank alongside info unless given a severity
+        consteval log_level(const std::string_view lbl, int sev = 2) noexcept : label(lbl), sev_(sev) {}
 
         [[nodiscard]] auto to_string_view() const noexcept
         {
             return label;
         }
 
+        [[nodiscard]] constexpr int severity() const noexcept
+        {
+            return sev_;
+        }
+
+        friend constexpr bool operator==(const log_level&, const log_level&) noexcept = default;
+
     private:
         std::string_view label;
+        int sev_;
     };
 
     inline namespace logger_literals {
-        inline constinit static const log_level trace{"TRACE"};
-        inline constinit static const log_level debug{"DEBUG"};
-        inline constinit static const log_level info{"INFO"};
-        inline constinit static const log_level warning{"WARNING"};
-        inline constinit static const log_level error{"ERROR"};
-        inline constinit static const log_level fatal{"FATAL"};
+        // constexpr so that call-site descriptors can embed them at compile time
+        inline constexpr log_level trace{"TRACE", 0};
+        inline constexpr log_level debug{"DEBUG", 1};
+        inline constexpr log_level info{"INFO", 2};
+        inline constexpr log_level warning{"WARNING", 3};
+        inline constexpr log_level error{"ERROR", 4};
+        inline constexpr log_level fatal{"FATAL", 5};
 
         inline consteval log_level operator""_lvl(const char* str, std::size_t len) noexcept
         {
@@ -72,9 +133,270 @@ namespace hyx {
         }
     } // namespace logger_literals
 
+    namespace detail {
+        inline constexpr int no_threshold{-1};
+
+        // overrides the threshold of every logger on this thread (no_threshold when unset)
+        inline constinit thread_local int thread_threshold{no_threshold};
+    } // namespace detail
+
+    // lets records down to lvl through on this thread only, for as long as it lives
+    // (e.g., debug output for the one request being traced)
+    class scoped_log_threshold {
+    public:
+        // not copyable or movable
+        explicit scoped_log_threshold(const scoped_log_threshold&) = delete;
+        explicit scoped_log_threshold(scoped_log_threshold&&) = delete;
+        scoped_log_threshold& operator=(const scoped_log_threshold&) = delete;
+        scoped_log_threshold& operator=(scoped_log_threshold&&) = delete;
+
+        explicit scoped_log_threshold(log_level lvl) noexcept : previous_(std::exchange(detail::thread_threshold, lvl.severity())) {}
+
+        ~scoped_log_threshold()
+        {
+            detail::thread_threshold = previous_;
+        }
+
+    private:
+        int previous_;
+    };
+
+    // compile-time metadata for one HYX_LOG statement
+    struct call_site {
+        std::string_view format;
+        log_level level;
+        std::source_location loc;
+
+        // small integer handle, assigned when the registry is first enumerated (0 until then)
+        std::uint32_t id{0};
+
+        // checked before anything else is done for the record (see set_call_sites_enabled())
+        std::atomic<bool> enabled{true};
+    };
+
+    namespace detail {
+        // descriptors registered at load time, see HYX_REGISTER_CALL_SITE
+        inline std::vector<call_site*>& loaded_call_sites()
+        {
+            static std::vector<call_site*> sites;
+            return sites;
+        }
+
+        // one instantiation per descriptor, whose static member is initialized when the program or
+        // shared object is loaded, before any of its functions run
+        template<call_site* Site>
+        struct call_site_registration {
+            static inline const bool registered = (loaded_call_sites().push_back(Site), true);
+        };
+    } // namespace detail
+
+    // every registered call site in the program, in registration order
+    inline std::span<call_site* const> call_sites()
+    {
+        static const std::vector<call_site*> sites = [] {
+            std::vector<call_site*> v;
+            // inlined or comdat-folded functions register the same descriptor more than once
+            const auto add = [&](call_site* site) {
+                if (site->id == 0) {
+                    v.push_back(site);
+                    site->id = static_cast<std::uint32_t>(v.size());
+                }
+            };
+#ifdef HYX_CALL_SITE_SECTION
+            for (auto it = __start_hyx_call_sites; it != __stop_hyx_call_sites; ++it) {
+                add(*it);
+            }
+#endif
+            for (auto* site : detail::loaded_call_sites()) {
+                add(site);
+            }
+            return v;
+        }();
+
+        return sites;
+    }
+
+    // looks up a call site by the id it was assigned in call_sites()
+    inline call_site* find_call_site(std::uint32_t id)
+    {
+        const auto sites = call_sites();
+        return id == 0 || id > sites.size() ? nullptr : sites[id - 1];
+    }
+
+    // selects call sites by any combination of file glob, function name substring and level
+    struct call_site_filter {
+        std::string_view file_glob{};
+        std::string_view function{};
+        std::optional<log_level> level{};
+    };
+
+    namespace detail {
+        // supports '*' (any run) and '?' (any one character)
+        constexpr bool glob_match(std::string_view pattern, std::string_view str) noexcept
+        {
+            std::size_t p = 0;
+            std::size_t s = 0;
+            std::size_t star = std::string_view::npos;
+            std::size_t retry = 0;
+
+            while (s < str.size()) {
+                if (p < pattern.size() && (pattern[p] == '?' || pattern[p] == str[s])) {
+                    ++p;
+                    ++s;
+                }
+                else if (p < pattern.size() && pattern[p] == '*') {
+                    star = p++;
+                    retry = s;
+                }
+                else if (star != std::string_view::npos) {
+                    p = star + 1;
+                    s = ++retry;
+                }
+                else {
+                    return false;
+                }
+            }
+
+            while (p < pattern.size() && pattern[p] == '*') {
+                ++p;
+            }
+
+            return p == pattern.size();
+        }
+
+        inline bool matches(const call_site_filter& filter, const call_site& site) noexcept
+        {
+            if (!filter.file_glob.empty()) {
+                // like dynamic debug, match either the full path or the base name
+                const std::string_view path{site.loc.file_name()};
+                const auto base = path.substr(path.find_last_of('/') + 1);
+                if (!glob_match(filter.file_glob, path) && !glob_match(filter.file_glob, base)) {
+                    return false;
+                }
+            }
+
+            if (!filter.function.empty() && !std::string_view{site.loc.function_name()}.contains(filter.function)) {
+                return false;
+            }
+
+            return !filter.level || *filter.level == site.level;
+        }
+    } // namespace detail
+
+    // turns matching call sites on or off at runtime and returns how many matched
+    inline std::size_t set_call_sites_enabled(const call_site_filter& filter, bool enabled)
+    {
+        std::size_t count = 0;
+        for (auto* site : call_sites()) {
+            if (detail::matches(filter, *site)) {
+                site->enabled.store(enabled, std::memory_order_relaxed);
+                ++count;
+            }
+        }
+
+        return count;
+    }
+
+    class logger;
+
+    namespace detail {
+        // arguments that can be copied now and formatted later without dangling
+        template<typename T>
+        concept deferrable_arg = std::is_arithmetic_v<T> || std::is_same_v<T, std::string>;
+    } // namespace detail
+
+    // holds the records a logger filters out on this thread and writes them only if
+    // an error (or worse) is logged before the scope ends; otherwise they are discarded
+    class tail_sampling_scope {
+    public:
+        // not copyable or movable
+        explicit tail_sampling_scope(const tail_sampling_scope&) = delete;
+        explicit tail_sampling_scope(tail_sampling_scope&&) = delete;
+        tail_sampling_scope& operator=(const tail_sampling_scope&) = delete;
+        tail_sampling_scope& operator=(tail_sampling_scope&&) = delete;
+
+        // keeps at most the last `capacity` records
+        explicit tail_sampling_scope(std::size_t capacity = 256);
+
+        ~tail_sampling_scope();
+
+        // records that were pushed out by newer ones
+        [[nodiscard]] std::size_t dropped() const noexcept
+        {
+            return dropped_;
+        }
+
+    private:
+        friend class logger;
+
+        struct deferred_record {
+            logger* lg;
+            log_level lvl;
+            std::source_location loc;
+            std::chrono::system_clock::time_point time;
+            std::string message{};
+            std::function<std::string()> render{};
+        };
+
+        template<typename... Args>
+        void capture(logger& lg, log_level lvl, const format_string_with_location<std::type_identity_t<Args>...>& fmt, Args&&... args);
+
+        void release();
+
+        std::size_t capacity_;
+        std::size_t dropped_{0};
+        bool released_{false};
+        std::deque<deferred_record> records_;
+        tail_sampling_scope* previous_;
+    };
+
+    namespace detail {
+        inline constinit thread_local tail_sampling_scope* tail_scope{nullptr};
+
+        // the slot bounded records are formatted into, only reallocated if the capacity grows
+        inline char* thread_record_slot(std::size_t capacity)
+        {
+            thread_local std::unique_ptr<char[]> slot;
+            thread_local std::size_t size = 0;
+            if (size < capacity) {
+                slot = std::make_unique_for_overwrite<char[]>(capacity);
+                size = capacity;
+            }
+
+            return slot.get();
+        }
+    } // namespace detail
+
+    namespace detail {
+        // everything records are written with, replaced as a whole while loggers are in use
+        struct logger_config {
+            int threshold{logger_literals::trace.severity()};
+            int flush_threshold{logger_literals::trace.severity()};
+            bool enabled{true};
+            std::shared_ptr<const header_plan> plan;
+            std::vector<std::shared_ptr<log_sink>> sinks;
+        };
+
+        inline logger_config make_logger_config(std::shared_ptr<log_sink> sink, std::string_view header, int flush_threshold = logger_literals::trace.severity())
+        {
+            logger_config cfg;
+            cfg.flush_threshold = flush_threshold;
+            cfg.plan = std::make_shared<const header_plan>(header);
+            cfg.sinks.push_back(std::move(sink));
+            return cfg;
+        }
+
+        // where a whole record is put together before it is handed to the sinks
+        inline std::string& thread_record_buffer()
+        {
+            thread_local std::string buf;
+            return buf;
+        }
+    } // namespace detail
+
     class logger {
     public:
-        logger() noexcept = default;
+        logger() : logger(detail::make_logger_config(std::make_shared<ostream_sink>(std::clog), "")) {}
 
         // not copyable or movable
         explicit logger(const logger&) = delete;
@@ -85,17 +407,31 @@ namespace hyx {
         ~logger() = default;
 
         template<typename... Args>
-        explicit logger(std::ostream& os, const header_string<std::type_identity_t<Args>...> fmt = "", Args&&... args) : sink_(os), header(std::format(fmt, std::forward<Args>(args)...)) {}
+        explicit logger(std::ostream& os, const header_string<std::type_identity_t<Args>...> fmt = "", Args&&... args) : logger(detail::make_logger_config(std::make_shared<ostream_sink>(os), std::format(fmt, std::forward<Args>(args)...)))
+        {
+        }
 
         template<typename... Args>
-        explicit logger(std::ofstream& ofs, const header_string<std::type_identity_t<Args>...> fmt = "", Args&&... args) : sink_(ofs), header(std::format(fmt, std::forward<Args>(args)...)) {}
+        explicit logger(const std::filesystem::path& path, const header_string<std::type_identity_t<Args>...> fmt = "", Args&&... args) : logger(detail::make_logger_config(shared_file_sink<file_sink>(path), std::format(fmt, std::forward<Args>(args)...)))
+        {
+        }
 
+        // also keeps a sparse (timestamp, offset) index next to the log, see <hyx/time_index.h>
         template<typename... Args>
-        explicit logger(const std::filesystem::path& path, const header_string<std::type_identity_t<Args>...> fmt = "", Args&&... args) : file_sink_(path, std::ios_base::app), sink_(file_sink_), header(std::format(fmt, std::forward<Args>(args)...))
+        explicit logger(const std::filesystem::path& path, sparse_time_index opts, const header_string<std::type_identity_t<Args>...> fmt = "", Args&&... args) : logger(detail::make_logger_config(shared_file_sink<indexed_file_sink>(path, opts), std::format(fmt, std::forward<Args>(args)...)))
+        {
+        }
+
+        // compressed output is only useful in whole blocks, so only errors and worse are flushed individually
+        template<typename... Args>
+        explicit logger(const std::filesystem::path& path, block_compression opts, const header_string<std::type_identity_t<Args>...> fmt = "", Args&&... args) : logger(detail::make_logger_config(shared_file_sink<compressed_file_sink>(path, opts), std::format(fmt, std::forward<Args>(args)...), logger_literals::error.severity()))
+        {
+        }
+
+        // writes to a sink of the caller's choosing (more can be added with add_sink())
+        template<typename... Args>
+        explicit logger(std::shared_ptr<log_sink> sink, const header_string<std::type_identity_t<Args>...> fmt = "", Args&&... args) : logger(detail::make_logger_config(std::move(sink), std::format(fmt, std::forward<Args>(args)...)))
         {
-            if (path.filename().empty()) {
-                throw std::invalid_argument("log output path does not contain a filename");
-            }
         }
 
         template<typename... Args>
@@ -104,92 +440,243 @@ namespace hyx {
             logger::operator()(logger_literals::info, fmt, std::forward<Args>(args)...);
         }
 
+        template<typename... Args>
+        void operator()(const call_site& site, const format_string_with_location<std::type_identity_t<Args>...>& fmt, Args&&... args)
+        {
+            // a disabled site costs one load and branch
+            if (!site.enabled.load(std::memory_order_relaxed)) [[unlikely]] {
+                return;
+            }
+
+            logger::operator()(site.level, fmt, std::forward<Args>(args)...);
+        }
+
         template<typename... Args>
         void operator()(log_level lvl, const format_string_with_location<std::type_identity_t<Args>...>& fmt, Args&&... args)
         {
-            // first output the header
-            format_scanner fc(header, std::ostream_iterator<char>(sink_), lvl, fmt.loc);
-            fc.scan();
+            log(threshold_.load(std::memory_order_relaxed), lvl, fmt, std::forward<Args>(args)...);
+        }
 
-            // now we can output log-site data
-            sink_ << std::format(fmt.fstr, std::forward<Args>(args)...);
+        // pushes any buffered records (including a partially filled compressed block) to the output
+        void flush()
+        {
+            const auto cfg = config_.read();
+            for (const auto& sink : cfg->sinks) {
+                sink->flush();
+            }
+        }
+
+        // the setters below publish a new configuration without stopping threads that are logging;
+        // they return once no record is being written with the old one (so a removed sink is no
+        // longer in use), and must not be called from inside a log statement of the same logger
+
+        // records below lvl are dropped (everything is let through by default)
+        void set_threshold(log_level lvl)
+        {
+            reconfigure([&](detail::logger_config& cfg) { cfg.threshold = lvl.severity(); });
+        }
+
+        // records at or above lvl are flushed to the output as soon as they are written, while
+        // records below it are batched by the underlying stream until a flush or a full buffer
+        // (every record is flushed by default, and errors and worse for compressed files)
+        void set_flush_threshold(log_level lvl)
+        {
+            reconfigure([&](detail::logger_config& cfg) { cfg.flush_threshold = lvl.severity(); });
+        }
+
+        template<typename... Args>
+        void set_header(const header_string<std::type_identity_t<Args>...> fmt, Args&&... args)
+        {
+            auto plan = std::make_shared<const header_plan>(std::format(fmt, std::forward<Args>(args)...));
+            reconfigure([&](detail::logger_config& cfg) { cfg.plan = std::move(plan); });
+            preload_tzdb();
+        }
+
+        void add_sink(std::shared_ptr<log_sink> sink)
+        {
+            reconfigure([&](detail::logger_config& cfg) { cfg.sinks.push_back(std::move(sink)); });
+        }
+
+        void remove_sink(const std::shared_ptr<log_sink>& sink)
+        {
+            reconfigure([&](detail::logger_config& cfg) { std::erase(cfg.sinks, sink); });
+        }
+
+        // formats each message into a preallocated per-thread slot of `bytes` (0 turns this off),
+        // cutting oversized ones short with a marker instead of growing a buffer to fit them
+        void set_record_capacity(std::size_t bytes)
+        {
+            if (bytes != 0 && bytes <= detail::truncation_reserve) {
+                throw std::invalid_argument("record capacity is too small to hold a truncation marker");
+            }
 
-            // we need both to ensure osyncstream outputs on each call
-            sink_.flush();
-            sink_.emit();
+            record_capacity_.store(bytes, std::memory_order_relaxed);
         }
 
         void disable()
         {
-            sink_.setstate(std::ios::failbit);
+            reconfigure([](detail::logger_config& cfg) { cfg.enabled = false; });
         }
 
         void enable()
         {
-            sink_.clear();
+            reconfigure([](detail::logger_config& cfg) { cfg.enabled = true; });
         }
 
     private:
-        template<typename OutIt>
-            requires(std::output_iterator<OutIt, const char&>)
-        class format_scanner : public basic_scanner {
-        public:
-            constexpr format_scanner(std::string_view fmt, OutIt out, log_level lvl, const std::source_location& sl) : basic_scanner(fmt), out_(out), lvl_(lvl), sl_(sl) {}
-
-        private:
-            OutIt out_;
-            log_level lvl_;
-            std::source_location sl_;
-
-            constexpr void on_event(iterator end) override
-            {
-                std::unique_copy(begin(), end, out_, [](auto a, auto b) { return (a == '[' && b == '[') || (a == ']' && b == ']'); });
-            }
-
-            constexpr void consume_spec(detail::spec_id id) override
-            {
-                const std::string_view fmt{"{:"s.append(std::string_view{ctx_.begin(), ctx_.subend()}).append("}")};
-
-                switch (id) {
-                    using enum hyx::detail::spec_id;
-                case lvl:
-                    std::vformat_to(out_, fmt, std::make_format_args(lvl_.to_string_view()));
-                    break;
-                case sys:
-                    std::vformat_to(out_, fmt, std::make_format_args(std::chrono::system_clock::now()));
-                    break;
-                case utc:
-                    std::vformat_to(out_, fmt, std::make_format_args(std::chrono::utc_clock::now()));
-                    break;
-                case tai:
-                    std::vformat_to(out_, fmt, std::make_format_args(std::chrono::tai_clock::now()));
-                    break;
-                case gps:
-                    std::vformat_to(out_, fmt, std::make_format_args(std::chrono::gps_clock::now()));
-                    break;
-                case file:
-                    std::vformat_to(out_, fmt, std::make_format_args(std::chrono::file_clock::now()));
-                    break;
-                case line:
-                    std::vformat_to(out_, fmt, std::make_format_args(sl_.line()));
-                    break;
-                case column:
-                    std::vformat_to(out_, fmt, std::make_format_args(sl_.column()));
-                    break;
-                case file_name:
-                    std::vformat_to(out_, fmt, std::make_format_args(sl_.file_name()));
-                    break;
-                case function_name:
-                    std::vformat_to(out_, fmt, std::make_format_args(sl_.function_name()));
-                    break;
+        friend class tail_sampling_scope;
+        friend class log_category;
+
+        // threshold is the logger's, or that of the category the record is logged through
+        template<typename... Args>
+        void log(int threshold, log_level lvl, const format_string_with_location<std::type_identity_t<Args>...>& fmt, Args&&... args)
+        {
+            // a thread override replaces the threshold, so this is one thread-local load
+            const auto tl = detail::thread_threshold;
+            if (lvl.severity() < (tl != detail::no_threshold ? tl : threshold)) {
+                // filtered records are only looked at again inside a tail_sampling_scope
+                if (auto* scope = detail::tail_scope; scope != nullptr) [[unlikely]] {
+                    scope->capture(*this, lvl, fmt, std::forward<Args>(args)...);
                 }
+                return;
             }
-        };
 
-        std::ofstream file_sink_{};
-        std::osyncstream sink_{std::clog};
-        std::string header;
+            if (lvl.severity() >= logger_literals::error.severity()) {
+                if (auto* scope = detail::tail_scope; scope != nullptr) [[unlikely]] {
+                    scope->release();
+                }
+            }
+
+            // (the clock is read before formatting so the timestamp marks when the call was made)
+            const auto now = std::chrono::system_clock::now();
+
+            if (const auto cap = record_capacity_.load(std::memory_order_relaxed); cap != 0) {
+                auto* slot = detail::thread_record_slot(cap);
+                write_record(lvl, fmt.loc, now, {slot, detail::format_truncated(slot, cap, fmt.fstr, std::forward<Args>(args)...)});
+            }
+            else {
+                write_record(lvl, fmt.loc, now, std::format(fmt.fstr, std::forward<Args>(args)...));
+            }
+        }
+
+
+        explicit logger(detail::logger_config cfg) : config_(std::move(cfg)), threshold_(config_.read()->threshold)
+        {
+            preload_tzdb();
+        }
+
+        template<typename F>
+        void reconfigure(F&& f)
+        {
+            config_.update([&](detail::logger_config& cfg) {
+                std::forward<F>(f)(cfg);
+                threshold_.store(cfg.threshold, std::memory_order_relaxed);
+            });
+        }
+
+        // see set_tzdb_preload()
+        void preload_tzdb()
+        {
+            using enum detail::spec_id;
+            const auto plan = config_.read()->plan;
+            const bool local_time = plan->uses(local);
+            if (!local_time && !plan->uses(utc) && !plan->uses(tai) && !plan->uses(gps)) {
+                return;
+            }
+
+            switch (detail::tzdb_preload_mode.load(std::memory_order_relaxed)) {
+            case tzdb_preload::none:
+                break;
+            case tzdb_preload::synchronous:
+                detail::warm_tzdb(local_time);
+                break;
+            case tzdb_preload::background:
+                tzdb_loader_ = std::jthread{[local_time] {
+                    // a failure resurfaces when the first record needs the tzdb
+                    try {
+                        detail::warm_tzdb(local_time);
+                    }
+                    catch (...) {
+                    }
+                }};
+                break;
+            }
+        }
+
+        void write_record(log_level lvl, const std::source_location& loc, std::chrono::system_clock::time_point now, std::string_view message)
+        {
+            // the configuration can't be freed before this record is written
+            const auto cfg = config_.read();
+            if (!cfg->enabled) {
+                return;
+            }
+
+            auto& record = detail::thread_record_buffer();
+            record.clear();
+            cfg->plan->render(std::back_inserter(record), lvl.to_string_view(), loc, now);
+            record.append(message);
+
+            // urgent records take everything batched before them along, so ordering is kept
+            const bool flush = lvl.severity() >= cfg->flush_threshold;
+            for (const auto& sink : cfg->sinks) {
+                sink->write(record, now, flush);
+            }
+        }
+
+        rcu_cell<detail::logger_config> config_;
+
+        // the configured threshold again, so filtered records never touch the configuration
+        std::atomic<int> threshold_;
+        std::atomic<std::size_t> record_capacity_{0};
+        std::jthread tzdb_loader_{};
     };
+
+    inline tail_sampling_scope::tail_sampling_scope(std::size_t capacity) : capacity_(capacity), previous_(std::exchange(detail::tail_scope, this)) {}
+
+    inline tail_sampling_scope::~tail_sampling_scope()
+    {
+        detail::tail_scope = previous_;
+    }
+
+    template<typename... Args>
+    void tail_sampling_scope::capture(logger& lg, log_level lvl, const format_string_with_location<std::type_identity_t<Args>...>& fmt, Args&&... args)
+    {
+        const auto now = std::chrono::system_clock::now();
+
+        // once the scope has failed there is nothing left to hold back
+        if (released_) {
+            lg.write_record(lvl, fmt.loc, now, std::format(fmt.fstr, std::forward<Args>(args)...));
+            return;
+        }
+
+        if (capacity_ == 0) {
+            ++dropped_;
+            return;
+        }
+        if (records_.size() == capacity_) {
+            records_.pop_front();
+            ++dropped_;
+        }
+
+        auto& rec = records_.emplace_back(&lg, lvl, fmt.loc, now);
+        if constexpr ((detail::deferrable_arg<std::remove_cvref_t<Args>> && ...)) {
+            // values are copied and only formatted if the scope fails
+            rec.render = [fstr = fmt.fstr, ... captured = std::forward<Args>(args)] { return std::vformat(fstr.get(), std::make_format_args(captured...)); };
+        }
+        else {
+            // anything that may refer to caller-owned memory is formatted now
+            rec.message = std::format(fmt.fstr, std::forward<Args>(args)...);
+        }
+    }
+
+    inline void tail_sampling_scope::release()
+    {
+        released_ = true;
+        for (auto& rec : records_) {
+            rec.lg->write_record(rec.lvl, rec.loc, rec.time, rec.render ? rec.render() : rec.message);
+        }
+        records_.clear();
+    }
 } // namespace hyx
 
 #endif // !HYX_LOGGER_H
@@ -0,0 +1,144 @@
+// <hyx/range_format.h> -*- C++ -*-
+// Copyright (C) 2023 Michael Pollak
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef HYX_RANGE_FORMAT_H
+#define HYX_RANGE_FORMAT_H
+
+#include <algorithm>
+#include <cstddef>
+#include <format>
+#include <ranges>
+#include <string_view>
+
+namespace hyx {
+    struct range_limits {
+        // elements past this are counted (when the range knows its size) instead of shown
+        std::size_t max_elements{16};
+        // output budget for the elements; no element is formatted once it's used up (the element
+        // that crosses it is still shown whole, as it's only measured after being written)
+        std::size_t max_bytes{1024};
+    };
+
+    namespace detail {
+        // passes writes through to out while counting them
+        template<typename Out>
+        struct counting_iterator {
+            using difference_type = std::ptrdiff_t;
+
+            Out out;
+            std::size_t count{0};
+
+            counting_iterator& operator*() noexcept
+            {
+                return *this;
+            }
+
+            counting_iterator& operator=(char c)
+            {
+                *out++ = c;
+                ++count;
+                return *this;
+            }
+
+            counting_iterator& operator++() noexcept
+            {
+                return *this;
+            }
+
+            counting_iterator& operator++(int) noexcept
+            {
+                return *this;
+            }
+        };
+    } // namespace detail
+
+    // formats a range as [a, b, c] while bounding the work done for it, e.g.,
+    // "[0, 1, 2, ... (first 3 of 10000 elements)]" (it only refers to the range, so pass it straight to the logger)
+    template<std::ranges::input_range R>
+        requires std::formattable<std::ranges::range_reference_t<const R>, char>
+    class bounded_range {
+    public:
+        explicit bounded_range(const R& range, range_limits limits = {}) noexcept : range_(range), limits_(limits) {}
+
+        [[nodiscard]] const R& range() const noexcept
+        {
+            return range_;
+        }
+
+        [[nodiscard]] const range_limits& limits() const noexcept
+        {
+            return limits_;
+        }
+
+    private:
+        const R& range_;
+        range_limits limits_;
+    };
+} // namespace hyx
+
+template<typename R>
+struct std::formatter<hyx::bounded_range<R>, char> {
+    constexpr auto parse(std::format_parse_context& pc)
+    {
+        const auto it = pc.begin();
+        if (it != pc.end() && *it != '}') {
+            throw std::format_error("format error: bounded_range takes no format spec");
+        }
+        return it;
+    }
+
+    template<typename FormatContext>
+    auto format(const hyx::bounded_range<R>& br, FormatContext& ctx) const
+    {
+        const auto& limits = br.limits();
+        auto out = ctx.out();
+        *out++ = '[';
+
+        // each element is formatted straight into the output, and the loop stops as soon as the
+        // budget is spent, so the elements after that are never formatted at all
+        hyx::detail::counting_iterator<decltype(out)> counted{out};
+        std::size_t shown = 0;
+        bool cut = false;
+        for (auto&& elem : br.range()) {
+            if (shown == limits.max_elements || counted.count >= limits.max_bytes) {
+                cut = true;
+                break;
+            }
+
+            if (shown != 0) {
+                counted = std::ranges::copy(std::string_view{", "}, counted).out;
+            }
+            counted = std::format_to(counted, "{}", elem);
+            ++shown;
+        }
+        out = counted.out;
+
+        if (cut) {
+            out = std::ranges::copy(std::string_view{shown == 0 ? "..." : ", ..."}, out).out;
+            if constexpr (std::ranges::sized_range<const R>) {
+                out = std::format_to(out, " (first {} of {} elements)", shown, std::ranges::size(br.range()));
+            }
+            else {
+                out = std::format_to(out, " (first {} elements)", shown);
+            }
+        }
+
+        *out++ = ']';
+        return out;
+    }
+};
+
+#endif // !HYX_RANGE_FORMAT_H
@@ -0,0 +1,187 @@
+// <hyx/rcu.h> -*- C++ -*-
+// Copyright (C) 2023 Michael Pollak
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef HYX_RCU_H
+#define HYX_RCU_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+namespace hyx {
+    namespace detail {
+        // the values one thread is reading through rcu_cell guards (one per nested guard), which no
+        // writer may free; only its thread writes to it, writers just scan it
+        struct alignas(64) rcu_reader {
+            static constexpr std::size_t max_nesting{8};
+
+            std::array<std::atomic<const void*>, max_nesting> reading{};
+            std::size_t depth{0};
+
+            std::atomic<bool> in_use{true};
+            rcu_reader* next{nullptr};
+        };
+
+        // every thread's record; records are never freed, a thread's is reused after it exits
+        inline std::atomic<rcu_reader*>& rcu_readers() noexcept
+        {
+            static std::atomic<rcu_reader*> head{nullptr};
+            return head;
+        }
+
+        inline rcu_reader* claim_rcu_reader()
+        {
+            auto& head = rcu_readers();
+            for (auto* r = head.load(std::memory_order_acquire); r != nullptr; r = r->next) {
+                bool expected = false;
+                if (!r->in_use.load(std::memory_order_relaxed) && r->in_use.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+                    return r;
+                }
+            }
+
+            auto* r = new rcu_reader;
+            r->next = head.load(std::memory_order_relaxed);
+            while (!head.compare_exchange_weak(r->next, r, std::memory_order_release, std::memory_order_relaxed)) {
+            }
+            return r;
+        }
+
+        struct rcu_reader_claim {
+            rcu_reader* reader{claim_rcu_reader()};
+
+            ~rcu_reader_claim()
+            {
+                reader->in_use.store(false, std::memory_order_release);
+            }
+        };
+
+        inline rcu_reader& this_rcu_reader()
+        {
+            thread_local const rcu_reader_claim claim;
+            return *claim.reader;
+        }
+    } // namespace detail
+
+    // an immutable value that readers use without locking while writers replace it;
+    // a replaced value is freed once every reader that could still be using it is done
+    //
+    // a reader announces the value it is about to use in its own thread's record and checks that
+    // it is still current, so readers never write to memory shared with other threads. a writer
+    // publishes the new value, then waits until no record announces the old one: a reader either
+    // announced it before the switch, and is waited for, or sees the switch and takes the new one
+    template<typename T>
+    class rcu_cell {
+    public:
+        class read_guard {
+        public:
+            // not copyable or movable
+            explicit read_guard(const read_guard&) = delete;
+            explicit read_guard(read_guard&&) = delete;
+            read_guard& operator=(const read_guard&) = delete;
+            read_guard& operator=(read_guard&&) = delete;
+
+            // (a thread can hold up to detail::rcu_reader::max_nesting guards at once)
+            explicit read_guard(const rcu_cell& cell) : reader_(detail::this_rcu_reader())
+            {
+                if (reader_.depth == detail::rcu_reader::max_nesting) [[unlikely]] {
+                    std::terminate();
+                }
+                slot_ = &reader_.reading[reader_.depth++];
+
+                auto* value = cell.current_.load(std::memory_order_relaxed);
+                while (true) {
+                    slot_->store(value, std::memory_order_seq_cst);
+                    auto* now = cell.current_.load(std::memory_order_seq_cst);
+                    if (now == value) {
+                        break;
+                    }
+                    value = now;
+                }
+                value_ = value;
+            }
+
+            ~read_guard()
+            {
+                slot_->store(nullptr, std::memory_order_release);
+                --reader_.depth;
+            }
+
+            const T& operator*() const noexcept
+            {
+                return *value_;
+            }
+
+            const T* operator->() const noexcept
+            {
+                return value_;
+            }
+
+        private:
+            detail::rcu_reader& reader_;
+            std::atomic<const void*>* slot_;
+            const T* value_;
+        };
+
+        // not copyable or movable
+        explicit rcu_cell(const rcu_cell&) = delete;
+        explicit rcu_cell(rcu_cell&&) = delete;
+        rcu_cell& operator=(const rcu_cell&) = delete;
+        rcu_cell& operator=(rcu_cell&&) = delete;
+
+        explicit rcu_cell(T value) : current_(new T(std::move(value))) {}
+
+        ~rcu_cell()
+        {
+            delete current_.load(std::memory_order_relaxed);
+        }
+
+        // valid until the guard goes out of scope (don't update() the same cell while holding one)
+        [[nodiscard]] read_guard read() const
+        {
+            return read_guard{*this};
+        }
+
+        // publishes a copy of the current value changed by f, then waits for the readers of the old one
+        template<typename F>
+        void update(F&& f)
+        {
+            const std::lock_guard lock{writer_};
+
+            auto next = std::make_unique<T>(*current_.load(std::memory_order_relaxed));
+            std::forward<F>(f)(*next);
+            std::unique_ptr<const T> old{current_.exchange(next.release(), std::memory_order_seq_cst)};
+
+            for (auto* r = detail::rcu_readers().load(std::memory_order_acquire); r != nullptr; r = r->next) {
+                for (const auto& slot : r->reading) {
+                    while (slot.load(std::memory_order_seq_cst) == old.get()) {
+                        std::this_thread::yield();
+                    }
+                }
+            }
+        }
+
+    private:
+        std::atomic<const T*> current_;
+        std::mutex writer_;
+    };
+} // namespace hyx
+
+#endif // !HYX_RCU_H
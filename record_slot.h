@@ -0,0 +1,172 @@
+// <hyx/record_slot.h> -*- C++ -*-
+// Copyright (C) 2023 Michael Pollak
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef HYX_RECORD_SLOT_H
+#define HYX_RECORD_SLOT_H
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <format>
+#include <string_view>
+#include <utility>
+
+namespace hyx {
+    namespace detail {
+        // room always left for the marker, e.g., " [truncated 123456789 bytes]\n"
+        inline constexpr std::size_t truncation_reserve{48};
+
+        // formats into [out, out + capacity) and, if the text doesn't fit, ends it with a marker
+        // saying how much was cut; returns the number of bytes used
+        template<typename... Args>
+        std::size_t format_truncated(char* out, std::size_t capacity, std::format_string<Args...> fmt, Args&&... args)
+        {
+            const auto res = std::format_to_n(out, static_cast<std::ptrdiff_t>(capacity), fmt, std::forward<Args>(args)...);
+            const auto full = static_cast<std::size_t>(res.size);
+            if (full <= capacity) {
+                return full;
+            }
+
+            // don't split a utf-8 sequence
+            auto keep = capacity - truncation_reserve;
+            while (keep != 0 && (static_cast<unsigned char>(out[keep]) & 0xc0) == 0x80) {
+                --keep;
+            }
+
+            // records usually end in a newline, which would otherwise be cut off with the rest
+            const bool newline = fmt.get().ends_with('\n');
+            const auto marker = std::format_to_n(out + keep, static_cast<std::ptrdiff_t>(capacity - keep), " [truncated {} bytes]{}", full - keep, newline ? "\n" : "");
+            return static_cast<std::size_t>(marker.out - out);
+        }
+    } // namespace detail
+
+    // a fixed-capacity buffer that one record is formatted into
+    template<std::size_t Capacity>
+        requires(Capacity > detail::truncation_reserve)
+    class record_slot {
+    public:
+        template<typename... Args>
+        std::string_view format(std::format_string<Args...> fmt, Args&&... args)
+        {
+            size_ = detail::format_truncated(bytes_.data(), Capacity, fmt, std::forward<Args>(args)...);
+            return view();
+        }
+
+        [[nodiscard]] std::string_view view() const noexcept
+        {
+            return {bytes_.data(), size_};
+        }
+
+    private:
+        std::array<char, Capacity> bytes_;
+        std::size_t size_{0};
+    };
+
+    // a bounded multi-producer multi-consumer ring of preallocated record slots; reserving a
+    // slot is a single compare-and-swap and nothing is allocated after construction
+    // (it holds no pointers, so it can also be placed in memory shared between processes)
+    template<std::size_t SlotSize, std::size_t Count>
+        requires(SlotSize > detail::truncation_reserve && Count != 0 && (Count & (Count - 1)) == 0)
+    class record_slot_ring {
+    public:
+        record_slot_ring() noexcept
+        {
+            for (std::size_t i = 0; i < Count; ++i) {
+                slots_[i].seq.store(i, std::memory_order_relaxed);
+            }
+        }
+
+        // not copyable or movable
+        record_slot_ring(const record_slot_ring&) = delete;
+        record_slot_ring& operator=(const record_slot_ring&) = delete;
+
+        // formats straight into a free slot; returns false (and formats nothing) when the ring is full
+        template<typename... Args>
+        bool try_push(std::format_string<Args...> fmt, Args&&... args)
+        {
+            auto pos = tail_.load(std::memory_order_relaxed);
+            while (true) {
+                auto& slot = slots_[pos & (Count - 1)];
+                const auto seq = slot.seq.load(std::memory_order_acquire);
+
+                if (seq == pos) {
+                    if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                        slot.size = detail::format_truncated(slot.bytes.data(), SlotSize, fmt, std::forward<Args>(args)...);
+                        slot.seq.store(pos + 1, std::memory_order_release);
+                        return true;
+                    }
+                }
+                else if (seq < pos) {
+                    return false;
+                }
+                else {
+                    pos = tail_.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        // hands the oldest record to f and frees its slot; returns false when the ring is empty
+        template<typename F>
+        bool try_pop(F&& f)
+        {
+            auto pos = head_.load(std::memory_order_relaxed);
+            while (true) {
+                auto& slot = slots_[pos & (Count - 1)];
+                const auto seq = slot.seq.load(std::memory_order_acquire);
+
+                if (seq == pos + 1) {
+                    if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                        // freed even if f throws (the record is then lost), as a slot that's never
+                        // freed would stop the ring for good once the producers wrap around to it
+                        const slot_release release{slot.seq, pos + Count};
+                        std::forward<F>(f)(std::string_view{slot.bytes.data(), slot.size});
+                        return true;
+                    }
+                }
+                else if (seq < pos + 1) {
+                    return false;
+                }
+                else {
+                    pos = head_.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+    private:
+        struct slot_release {
+            std::atomic<std::uint64_t>& seq;
+            std::uint64_t next;
+
+            ~slot_release()
+            {
+                seq.store(next, std::memory_order_release);
+            }
+        };
+
+        struct slot {
+            std::atomic<std::uint64_t> seq;
+            std::size_t size;
+            std::array<char, SlotSize> bytes;
+        };
+
+        // keep producers and consumers off each other's cache lines
+        alignas(64) std::atomic<std::uint64_t> tail_{0};
+        alignas(64) std::atomic<std::uint64_t> head_{0};
+        alignas(64) std::array<slot, Count> slots_;
+    };
+} // namespace hyx
+
+#endif // !HYX_RECORD_SLOT_H
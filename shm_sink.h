@@ -0,0 +1,198 @@
+// <hyx/shm_sink.h> -*- C++ -*-
+// Copyright (C) 2023 Michael Pollak
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef HYX_SHM_SINK_H
+#define HYX_SHM_SINK_H
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <hyx/record_slot.h>
+#include <hyx/sink.h>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// hands records to a logging daemon (tools/logd.cpp) through a queue in shared memory (linux only)
+
+namespace hyx {
+    namespace detail {
+        inline constexpr std::size_t shm_slot_size{2048};
+        inline constexpr std::size_t shm_slot_count{4096};
+
+        // the layout of the shared memory object; the daemon creates it and outlives its producers,
+        // so records a crashed producer managed to push are still written
+        struct shm_log_queue {
+            // "hyxlogq" and a layout version, set once the daemon has constructed the rest
+            static constexpr std::uint64_t ready_tag{0x6879786c6f677101};
+
+            std::atomic<std::uint64_t> tag{0};
+            std::uint64_t slot_size{shm_slot_size};
+            std::uint64_t slot_count{shm_slot_count};
+
+            // records that didn't fit into a full queue, reported (and reset) by the daemon
+            alignas(64) std::atomic<std::uint64_t> dropped{0};
+            // futex word bumped after every push; the daemon sleeps on it while `sleeping` is set
+            alignas(64) std::atomic<std::uint32_t> pushes{0};
+            std::atomic<std::uint32_t> sleeping{0};
+
+            record_slot_ring<shm_slot_size, shm_slot_count> ring;
+        };
+
+        static_assert(std::atomic<std::uint64_t>::is_always_lock_free && std::atomic<std::uint32_t>::is_always_lock_free, "shared memory queue needs address-free atomics");
+
+        // shared between processes, so no FUTEX_PRIVATE_FLAG
+        inline void futex_wait(std::atomic<std::uint32_t>& word, std::uint32_t seen, std::chrono::milliseconds timeout) noexcept
+        {
+            const auto secs = std::chrono::duration_cast<std::chrono::seconds>(timeout);
+            const timespec ts{static_cast<time_t>(secs.count()), static_cast<long>(std::chrono::nanoseconds{timeout - secs}.count())};
+            ::syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&word), FUTEX_WAIT, seen, &ts, nullptr, 0);
+        }
+
+        inline void futex_wake(std::atomic<std::uint32_t>& word) noexcept
+        {
+            ::syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&word), FUTEX_WAKE, 1, nullptr, nullptr, 0);
+        }
+
+        // maps the queue named name (e.g., "/myapp-log"), which the daemon creates unless attach_only is set
+        class shm_log_mapping {
+        public:
+            // not copyable or movable
+            explicit shm_log_mapping(const shm_log_mapping&) = delete;
+            explicit shm_log_mapping(shm_log_mapping&&) = delete;
+            shm_log_mapping& operator=(const shm_log_mapping&) = delete;
+            shm_log_mapping& operator=(shm_log_mapping&&) = delete;
+
+            shm_log_mapping(const std::string& name, bool attach_only)
+            {
+                const int fd = ::shm_open(name.c_str(), attach_only ? O_RDWR : O_RDWR | O_CREAT, 0600);
+                if (fd < 0) {
+                    throw std::system_error(errno, std::generic_category(), "could not open log queue " + name);
+                }
+
+                // (a queue left behind by an earlier daemon is kept as it is, records and all)
+                if (!attach_only && ::ftruncate(fd, sizeof(shm_log_queue)) != 0) {
+                    const auto err = errno;
+                    ::close(fd);
+                    throw std::system_error(err, std::generic_category(), "could not size log queue " + name);
+                }
+
+                // touching a mapping past the end of the object raises SIGBUS, and the daemon may not have sized it yet
+                struct stat st{};
+                if (::fstat(fd, &st) != 0 || static_cast<std::size_t>(st.st_size) < sizeof(shm_log_queue)) {
+                    ::close(fd);
+                    throw std::runtime_error("log queue " + name + " has not been set up by the daemon");
+                }
+
+                void* mem = ::mmap(nullptr, sizeof(shm_log_queue), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+                const auto err = errno;
+                ::close(fd);
+                if (mem == MAP_FAILED) {
+                    throw std::system_error(err, std::generic_category(), "could not map log queue " + name);
+                }
+                mem_ = mem;
+
+                auto* existing = std::launder(static_cast<shm_log_queue*>(mem_));
+                if (existing->tag.load(std::memory_order_acquire) == shm_log_queue::ready_tag) {
+                    queue_ = existing;
+                    if (queue_->slot_size != shm_slot_size || queue_->slot_count != shm_slot_count) {
+                        ::munmap(mem_, sizeof(shm_log_queue));
+                        throw std::runtime_error("log queue " + name + " has a different layout");
+                    }
+                }
+                else if (attach_only) {
+                    ::munmap(mem_, sizeof(shm_log_queue));
+                    throw std::runtime_error("log queue " + name + " has not been set up by the daemon");
+                }
+                else {
+                    queue_ = new (mem_) shm_log_queue;
+                    queue_->tag.store(shm_log_queue::ready_tag, std::memory_order_release);
+                }
+            }
+
+            ~shm_log_mapping()
+            {
+                ::munmap(mem_, sizeof(shm_log_queue));
+            }
+
+            shm_log_queue& queue() const noexcept
+            {
+                return *queue_;
+            }
+
+        private:
+            void* mem_;
+            shm_log_queue* queue_;
+        };
+    } // namespace detail
+
+    // pushes finished records onto the queue of a logging daemon (tools/logd.cpp), which does the
+    // compression and i/o; a push is a compare-and-swap and a copy, plus a futex wake when the
+    // daemon is asleep. records longer than a slot are truncated, and records that find the queue
+    // full are dropped and counted (the daemon reports them). the header is still rendered here,
+    // as a record's arguments may refer to memory the daemon can't see
+    //
+    // a producer that dies halfway through a push leaves its slot unpublished, which stalls the
+    // queue at that record for good (remove the queue from /dev/shm and restart the daemon)
+    class shm_sink : public log_sink {
+    public:
+        // name is the daemon's queue, e.g., "/myapp-log"; throws if the daemon hasn't created it
+        explicit shm_sink(const std::string& name) : mapping_(name, true) {}
+
+        // records reach the output whenever the daemon gets to them, flushed or not
+        void write(std::string_view record, std::chrono::system_clock::time_point, bool) override
+        {
+            auto& q = mapping_.queue();
+
+            // (pushed as "{}\n" so that a truncated record keeps its newline)
+            const bool pushed = record.ends_with('\n') ? q.ring.try_push("{}\n", record.substr(0, record.size() - 1)) : q.ring.try_push("{}", record);
+            if (!pushed) {
+                q.dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+
+            // pairs with the daemon setting `sleeping` before it looks at `pushes` one last time
+            q.pushes.fetch_add(1, std::memory_order_seq_cst);
+            if (q.sleeping.load(std::memory_order_seq_cst) != 0) {
+                detail::futex_wake(q.pushes);
+            }
+        }
+
+        void flush() override
+        {
+            auto& q = mapping_.queue();
+            if (q.sleeping.load(std::memory_order_seq_cst) != 0) {
+                detail::futex_wake(q.pushes);
+            }
+        }
+
+    private:
+        detail::shm_log_mapping mapping_;
+    };
+} // namespace hyx
+
+#endif // !HYX_SHM_SINK_H
@@ -0,0 +1,199 @@
+// <hyx/sink.h> -*- C++ -*-
+// Copyright (C) 2023 Michael Pollak
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef HYX_SINK_H
+#define HYX_SINK_H
+
+#include <chrono>
+#include <concepts>
+#include <filesystem>
+#include <fstream>
+#include <hyx/compressed_file.h>
+#include <hyx/time_index.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <string_view>
+#include <syncstream>
+
+namespace hyx {
+    // where a logger's finished records go; write() is called concurrently from every logging thread
+    class log_sink {
+    public:
+        virtual ~log_sink() = default;
+
+        // one whole record (header included); with flush set, it and everything before it
+        // should reach the output before returning, otherwise it may be batched
+        virtual void write(std::string_view record, std::chrono::system_clock::time_point time, bool flush) = 0;
+
+        virtual void flush() = 0;
+    };
+
+    namespace detail {
+        // each record goes through its own osyncstream, so records from different threads never interleave
+        inline void write_synced(std::ostream& os, std::string_view record, bool flush)
+        {
+            std::osyncstream out{os};
+            out.write(record.data(), static_cast<std::streamsize>(record.size()));
+            if (flush) {
+                out.flush();
+            }
+        }
+
+        inline std::filesystem::path checked_log_path(const std::filesystem::path& path)
+        {
+            if (path.filename().empty()) {
+                throw std::invalid_argument("log output path does not contain a filename");
+            }
+            return path;
+        }
+    } // namespace detail
+
+    // writes to a stream owned by someone else (e.g., std::clog)
+    class ostream_sink : public log_sink {
+    public:
+        explicit ostream_sink(std::ostream& os) noexcept : os_(os) {}
+
+        void write(std::string_view record, std::chrono::system_clock::time_point, bool flush) override
+        {
+            detail::write_synced(os_, record, flush);
+        }
+
+        void flush() override
+        {
+            std::osyncstream{os_}.flush();
+        }
+
+    private:
+        std::ostream& os_;
+    };
+
+    // appends to a file
+    class file_sink : public log_sink {
+    public:
+        explicit file_sink(const std::filesystem::path& path) : file_(detail::checked_log_path(path), std::ios_base::app) {}
+
+        void write(std::string_view record, std::chrono::system_clock::time_point, bool flush) override
+        {
+            detail::write_synced(file_, record, flush);
+        }
+
+        void flush() override
+        {
+            std::osyncstream{file_}.flush();
+        }
+
+    private:
+        std::ofstream file_;
+    };
+
+    // appends to a file and keeps a sparse (timestamp, offset) index next to it, see <hyx/time_index.h>
+    class indexed_file_sink : public log_sink {
+    public:
+        indexed_file_sink(const std::filesystem::path& path, sparse_time_index opts) : file_(detail::checked_log_path(path), std::ios_base::app), index_(path, file_.rdbuf(), opts) {}
+
+        void write(std::string_view record, std::chrono::system_clock::time_point time, bool flush) override
+        {
+            // the offset has to belong to this record, so records are written one at a time
+            const std::lock_guard lock{mutex_};
+            const auto offset = index_.position();
+            index_.rdbuf()->sputn(record.data(), static_cast<std::streamsize>(record.size()));
+            if (flush) {
+                index_.rdbuf()->pubsync();
+            }
+            index_.on_record(time, offset);
+        }
+
+        void flush() override
+        {
+            const std::lock_guard lock{mutex_};
+            index_.rdbuf()->pubsync();
+        }
+
+    private:
+        std::mutex mutex_;
+        std::ofstream file_;
+        time_index_writer index_;
+    };
+
+    // block-compressed file, see <hyx/compressed_file.h>; flushing seals the current block
+    class compressed_file_sink : public log_sink {
+    public:
+        compressed_file_sink(const std::filesystem::path& path, block_compression opts) : buf_(path, opts) {}
+
+        void write(std::string_view record, std::chrono::system_clock::time_point, bool flush) override
+        {
+            // the buffer takes whole writes under its own lock
+            buf_.sputn(record.data(), static_cast<std::streamsize>(record.size()));
+            if (flush) {
+                buf_.pubsync();
+            }
+        }
+
+        void flush() override
+        {
+            buf_.pubsync();
+        }
+
+    private:
+        compressed_filebuf buf_;
+    };
+
+    namespace detail {
+        // every file sink in the process, by canonical path
+        struct file_sink_registry {
+            std::mutex mutex;
+            std::map<std::filesystem::path, std::weak_ptr<log_sink>> sinks;
+        };
+
+        inline file_sink_registry& file_sinks()
+        {
+            static file_sink_registry reg;
+            return reg;
+        }
+    } // namespace detail
+
+    // the sink already writing to path, or a new Sink(path, args...) if there is none, so every
+    // logger writing to a file shares one stream (while it lasts, the first sink's options win)
+    template<typename Sink, typename... Args>
+        requires std::derived_from<Sink, log_sink>
+    std::shared_ptr<Sink> shared_file_sink(const std::filesystem::path& path, Args&&... args)
+    {
+        // (the file may not exist yet, so only the existing part of the path is resolved)
+        const auto key = std::filesystem::weakly_canonical(std::filesystem::absolute(detail::checked_log_path(path)));
+
+        auto& reg = detail::file_sinks();
+        const std::lock_guard lock{reg.mutex};
+        if (const auto it = reg.sinks.find(key); it != reg.sinks.end()) {
+            if (auto existing = it->second.lock()) {
+                auto sink = std::dynamic_pointer_cast<Sink>(existing);
+                if (!sink) {
+                    throw std::invalid_argument("log file is already written by a different kind of sink");
+                }
+                return sink;
+            }
+        }
+
+        std::erase_if(reg.sinks, [](const auto& entry) { return entry.second.expired(); });
+        auto sink = std::make_shared<Sink>(path, std::forward<Args>(args)...);
+        reg.sinks[key] = sink;
+        return sink;
+    }
+} // namespace hyx
+
+#endif // !HYX_SINK_H
@@ -0,0 +1,179 @@
+// <hyx/tests/compressed_file.cpp> -*- C++ -*-
+// Copyright (C) 2023 Michael Pollak
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+// round-trips, crash truncation and reopening of the block-compressed log format;
+// exits with 1 after printing the failed checks (checks may run on several threads)
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <hyx/compressed_file.h>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+    std::atomic<int> failures{0};
+
+    void check(bool ok, const char* what)
+    {
+        if (!ok) {
+            std::cerr << "FAILED: " << what << '\n';
+            ++failures;
+        }
+    }
+
+    std::filesystem::path temp_log(const char* name)
+    {
+        auto path = std::filesystem::temp_directory_path() / name;
+        std::filesystem::remove(path);
+        return path;
+    }
+
+    // writes records "line <i> hello world\n" for i in [from, to), one sputn each, as compressed_file_sink does
+    std::string write_records(const std::filesystem::path& path, int from, int to, hyx::block_compression opts)
+    {
+        std::string expected;
+        hyx::compressed_filebuf buf(path, opts);
+        for (int i = from; i < to; ++i) {
+            const auto record = "line " + std::to_string(i) + " hello world\n";
+            buf.sputn(record.data(), static_cast<std::streamsize>(record.size()));
+            expected += record;
+        }
+
+        return expected;
+    }
+
+    std::pair<std::string, bool> read_log(const std::filesystem::path& path)
+    {
+        std::ifstream in(path, std::ios_base::binary);
+        std::ostringstream out;
+        const bool complete = hyx::decompress_log(in, out);
+        return {out.str(), complete};
+    }
+
+    void round_trip()
+    {
+        const auto path = temp_log("hyx_round_trip.hyxb");
+        const auto expected = write_records(path, 0, 5000, {.block_size = 4096});
+        const auto [text, complete] = read_log(path);
+        check(complete, "round trip: log is complete");
+        check(text == expected, "round trip: contents match");
+
+        // a record longer than a block gets a block of its own
+        const auto big_path = temp_log("hyx_big_record.hyxb");
+        const std::string big(10000, 'x');
+        {
+            hyx::compressed_filebuf buf(big_path, {.block_size = 1024});
+            buf.sputn("a\n", 2);
+            buf.sputn(big.data(), static_cast<std::streamsize>(big.size()));
+            buf.sputn("b\n", 2);
+        }
+        check(read_log(big_path).first == "a\n" + big + "b\n", "round trip: oversize record");
+    }
+
+    void crash_truncation()
+    {
+        const auto path = temp_log("hyx_crash.hyxb");
+        write_records(path, 0, 5000, {.block_size = 4096});
+
+        // losing the end of the file, even in the middle of a header, keeps whole records readable
+        const auto full = std::filesystem::file_size(path);
+        for (const auto cut : {full - 1, full - 100, full - 1000}) {
+            std::filesystem::resize_file(path, cut);
+            const auto [text, complete] = read_log(path);
+            check(!complete, "crash: truncation is reported");
+            check(!text.empty() && text.ends_with(" hello world\n"), "crash: readable data ends in a whole record");
+        }
+
+        // reopening drops the torn block and carries on after the last whole record
+        const auto [before, complete] = read_log(path);
+        const auto appended = write_records(path, 5000, 5100, {.block_size = 4096});
+        const auto [after, now_complete] = read_log(path);
+        check(now_complete, "reopen: log is complete again");
+        check(after == before + appended, "reopen: new records follow the surviving ones");
+    }
+
+    // flushes waiting while other threads keep sealing blocks (the worker may get past their
+    // block before they wake up)
+    void concurrent_flush()
+    {
+        const auto path = temp_log("hyx_concurrent.hyxb");
+        {
+            hyx::compressed_filebuf buf(path, {.block_size = 256});
+            std::vector<std::jthread> threads;
+            for (int t = 0; t < 4; ++t) {
+                threads.emplace_back([&buf, t] {
+                    for (int i = 0; i < 3000; ++i) {
+                        const auto record = "thread " + std::to_string(t) + " line " + std::to_string(i) + "\n";
+                        buf.sputn(record.data(), static_cast<std::streamsize>(record.size()));
+                        if (i % 50 == 0) {
+                            check(buf.pubsync() == 0, "concurrent: flush succeeds");
+                        }
+                    }
+                });
+            }
+        }
+
+        const auto [text, complete] = read_log(path);
+        check(complete, "concurrent: log is complete");
+        check(std::ranges::count(text, '\n') == 4 * 3000, "concurrent: every record is there");
+    }
+
+    void foreign_files()
+    {
+        // an existing plain-text log is refused instead of truncated
+        const auto path = temp_log("hyx_plain.log");
+        {
+            std::ofstream out(path);
+            out << "a plain text log line\n";
+        }
+        const auto size = std::filesystem::file_size(path);
+        bool refused = false;
+        try {
+            hyx::compressed_filebuf buf(path);
+        }
+        catch (const std::invalid_argument&) {
+            refused = true;
+        }
+        check(refused, "foreign file: refused");
+        check(std::filesystem::file_size(path) == size, "foreign file: left untouched");
+
+        bool zero_refused = false;
+        try {
+            hyx::compressed_filebuf buf(temp_log("hyx_zero.hyxb"), {.block_size = 0});
+        }
+        catch (const std::invalid_argument&) {
+            zero_refused = true;
+        }
+        check(zero_refused, "zero block size: refused");
+    }
+} // namespace
+
+int main()
+{
+    round_trip();
+    crash_truncation();
+    concurrent_flush();
+    foreign_files();
+
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
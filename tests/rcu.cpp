@@ -0,0 +1,121 @@
+// <hyx/tests/rcu.cpp> -*- C++ -*-
+// Copyright (C) 2023 Michael Pollak
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+// readers racing writers on rcu_cell, with reader threads coming and going and guards nested
+// past the per-thread slots; meant to be run under asan or tsan as well. exits with 1 after
+// printing the failed checks (checks may run on several threads)
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <functional>
+#include <hyx/rcu.h>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+namespace {
+    std::atomic<int> failures{0};
+
+    void check(bool ok, const char* what)
+    {
+        if (!ok) {
+            std::cerr << "FAILED: " << what << '\n';
+            ++failures;
+        }
+    }
+
+    // every field is written together, so a reader seeing a mix got a value that was changed or freed
+    struct value {
+        long a;
+        long b;
+        std::vector<int> payload;
+    };
+
+    bool consistent(const value& v)
+    {
+        return v.a == v.b && v.payload.size() == 100 && std::ranges::all_of(v.payload, [&](int x) { return x == v.a % 1000; });
+    }
+
+    void set(value& v, long i)
+    {
+        v.a = v.b = i;
+        std::ranges::fill(v.payload, static_cast<int>(i % 1000));
+    }
+
+    // each reader thread lives for a short while, so the per-thread records get reused
+    void churning_readers()
+    {
+        hyx::rcu_cell<value> first{value{0, 0, std::vector<int>(100, 0)}};
+        hyx::rcu_cell<value> second{value{0, 0, std::vector<int>(100, 0)}};
+        std::atomic<bool> stop{false};
+
+        std::vector<std::jthread> readers;
+        for (int t = 0; t < 4; ++t) {
+            readers.emplace_back([&] {
+                while (!stop.load()) {
+                    std::jthread([&] {
+                        for (int i = 0; i < 500; ++i) {
+                            const auto g1 = first.read();
+                            const auto g2 = second.read();
+                            check(consistent(*g1) && consistent(*g2), "churn: reads see whole values");
+                        }
+                    }).join();
+                }
+            });
+        }
+
+        for (long i = 1; i < 5000; ++i) {
+            first.update([i](value& v) { set(v, i); });
+            second.update([i](value& v) { set(v, -i); });
+        }
+        stop = true;
+    }
+
+    // guards nested past the per-thread slots fall back to the shared list and still hold their value
+    void deep_nesting()
+    {
+        hyx::rcu_cell<value> cell{value{0, 0, std::vector<int>(100, 0)}};
+        std::atomic<bool> stop{false};
+
+        std::jthread writer([&] {
+            for (long i = 1; !stop.load(); ++i) {
+                cell.update([i](value& v) { set(v, i); });
+            }
+        });
+
+        for (int round = 0; round < 2000; ++round) {
+            std::function<void(int)> nest = [&](int depth) {
+                const auto g = cell.read();
+                const auto seen = g->a;
+                if (depth != 0) {
+                    nest(depth - 1);
+                }
+                check(consistent(*g) && g->a == seen, "nesting: a guard keeps its value");
+            };
+            nest(20);
+        }
+        stop = true;
+    }
+} // namespace
+
+int main()
+{
+    churning_readers();
+    deep_nesting();
+
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,230 @@
+// <hyx/time_index.h> -*- C++ -*-
+// Copyright (C) 2023 Michael Pollak
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef HYX_TIME_INDEX_H
+#define HYX_TIME_INDEX_H
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include <streambuf>
+#include <utility>
+
+// a time index is a sidecar file (<log>.idx) of fixed-size little-endian entries
+//   i64 nanoseconds since the system_clock epoch | u64 byte offset of the record in the log
+// written every so many records or bytes. entries are in write order, which is time
+// order up to the skew between threads logging concurrently.
+
+namespace hyx {
+    struct sparse_time_index {
+        // an entry is written once either limit is reached since the last one
+        std::size_t every_records{1024};
+        std::uintmax_t every_bytes{1024 * 1024};
+    };
+
+    struct time_index_entry {
+        std::chrono::sys_time<std::chrono::nanoseconds> time;
+        std::uint64_t offset;
+    };
+
+    namespace detail {
+        inline constexpr std::size_t time_index_entry_size{16};
+
+        inline std::filesystem::path time_index_path(std::filesystem::path log_path)
+        {
+            return log_path += ".idx";
+        }
+
+        // forwards to another streambuf while counting the bytes that pass through
+        class counting_streambuf : public std::streambuf {
+        public:
+            counting_streambuf(std::streambuf* target, std::uint64_t start) : target_(target), count_(start) {}
+
+            [[nodiscard]] std::uint64_t count() const noexcept
+            {
+                return count_;
+            }
+
+        protected:
+            std::streamsize xsputn(const char_type* s, std::streamsize n) override
+            {
+                const auto written = target_->sputn(s, n);
+                count_ += static_cast<std::uint64_t>(written);
+                return written;
+            }
+
+            int_type overflow(int_type ch) override
+            {
+                if (traits_type::eq_int_type(ch, traits_type::eof())) {
+                    return traits_type::not_eof(ch);
+                }
+
+                const auto res = target_->sputc(traits_type::to_char_type(ch));
+                if (!traits_type::eq_int_type(res, traits_type::eof())) {
+                    ++count_;
+                }
+                return res;
+            }
+
+            int sync() override
+            {
+                return target_->pubsync();
+            }
+
+        private:
+            std::streambuf* target_;
+            std::uint64_t count_;
+        };
+    } // namespace detail
+
+    // keeps the sidecar index for one log file; records pass through rdbuf()
+    class time_index_writer {
+    public:
+        // not copyable or movable
+        explicit time_index_writer(const time_index_writer&) = delete;
+        explicit time_index_writer(time_index_writer&&) = delete;
+        time_index_writer& operator=(const time_index_writer&) = delete;
+        time_index_writer& operator=(time_index_writer&&) = delete;
+
+        time_index_writer(const std::filesystem::path& log_path, std::streambuf* log_buf, sparse_time_index opts) : opts_(opts), index_(detail::time_index_path(log_path), std::ios_base::binary | std::ios_base::app), counter_(log_buf, existing_size(log_path))
+        {
+            if (!index_) {
+                throw std::runtime_error("could not open log time index");
+            }
+        }
+
+        [[nodiscard]] std::streambuf* rdbuf() noexcept
+        {
+            return &counter_;
+        }
+
+        // offset the next record will start at
+        [[nodiscard]] std::uint64_t position() const noexcept
+        {
+            return counter_.count();
+        }
+
+        void on_record(std::chrono::system_clock::time_point time, std::uint64_t offset)
+        {
+            ++records_since_;
+            if (!first_ && records_since_ < opts_.every_records && offset - last_offset_ < opts_.every_bytes) {
+                return;
+            }
+
+            const auto ns = std::chrono::time_point_cast<std::chrono::nanoseconds>(time).time_since_epoch().count();
+            std::array<char, detail::time_index_entry_size> entry;
+            for (std::size_t i = 0; i < 8; ++i) {
+                entry[i] = static_cast<char>((static_cast<std::uint64_t>(ns) >> (8 * i)) & 0xff);
+                entry[8 + i] = static_cast<char>((offset >> (8 * i)) & 0xff);
+            }
+            index_.write(entry.data(), entry.size());
+            index_.flush();
+
+            first_ = false;
+            records_since_ = 0;
+            last_offset_ = offset;
+        }
+
+    private:
+        static std::uint64_t existing_size(const std::filesystem::path& path)
+        {
+            std::error_code ec;
+            const auto size = std::filesystem::file_size(path, ec);
+            return ec ? 0 : size;
+        }
+
+        sparse_time_index opts_;
+        std::ofstream index_;
+        detail::counting_streambuf counter_;
+        bool first_{true};
+        std::size_t records_since_{0};
+        std::uint64_t last_offset_{0};
+    };
+
+    // binary searches an index file in place, reading O(log n) entries per lookup
+    class time_index {
+    public:
+        explicit time_index(const std::filesystem::path& log_path) : file_(detail::time_index_path(log_path), std::ios_base::binary)
+        {
+            if (!file_) {
+                throw std::runtime_error("could not open log time index");
+            }
+
+            file_.seekg(0, std::ios_base::end);
+            // a partially written trailing entry is ignored
+            size_ = static_cast<std::size_t>(file_.tellg()) / detail::time_index_entry_size;
+        }
+
+        [[nodiscard]] std::size_t size() const noexcept
+        {
+            return size_;
+        }
+
+        [[nodiscard]] time_index_entry operator[](std::size_t pos)
+        {
+            std::array<char, detail::time_index_entry_size> entry;
+            file_.seekg(static_cast<std::streamoff>(pos * detail::time_index_entry_size));
+            file_.read(entry.data(), entry.size());
+
+            std::uint64_t ns = 0;
+            std::uint64_t offset = 0;
+            for (std::size_t i = 0; i < 8; ++i) {
+                ns |= static_cast<std::uint64_t>(static_cast<unsigned char>(entry[i])) << (8 * i);
+                offset |= static_cast<std::uint64_t>(static_cast<unsigned char>(entry[8 + i])) << (8 * i);
+            }
+
+            return {std::chrono::sys_time<std::chrono::nanoseconds>{std::chrono::nanoseconds{static_cast<std::int64_t>(ns)}}, offset};
+        }
+
+        // byte range [first, second) of the log that holds every record stamped in [from, to)
+        // (it may include up to one index interval of records on either side)
+        [[nodiscard]] std::pair<std::uint64_t, std::uint64_t> find(std::chrono::system_clock::time_point from, std::chrono::system_clock::time_point to)
+        {
+            const auto first = upper_bound(from);
+            const auto last = upper_bound(to);
+
+            return {first == 0 ? 0 : (*this)[first - 1].offset, last == size_ ? std::numeric_limits<std::uint64_t>::max() : (*this)[last].offset};
+        }
+
+    private:
+        // index of the first entry stamped after t
+        std::size_t upper_bound(std::chrono::system_clock::time_point t)
+        {
+            std::size_t lo = 0;
+            std::size_t hi = size_;
+            while (lo < hi) {
+                const auto mid = lo + (hi - lo) / 2;
+                if ((*this)[mid].time <= t) {
+                    lo = mid + 1;
+                }
+                else {
+                    hi = mid;
+                }
+            }
+
+            return lo;
+        }
+
+        std::ifstream file_;
+        std::size_t size_;
+    };
+} // namespace hyx
+
+#endif // !HYX_TIME_INDEX_H
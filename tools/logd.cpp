@@ -0,0 +1,118 @@
+// <hyx/tools/logd.cpp> -*- C++ -*-
+// Copyright (C) 2023 Michael Pollak
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+// usage: logd [-c] <queue name> <log file>
+// creates the shared memory queue (e.g., "/myapp-log") that hyx::shm_sink pushes records onto and
+// appends them to the log file, block-compressed with -c (see <hyx/compressed_file.h>); runs until
+// SIGINT or SIGTERM, and leaves the queue in place so that records pushed meanwhile are written by
+// the next run
+
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <exception>
+#include <format>
+#include <hyx/fd_sink.h>
+#include <hyx/shm_sink.h>
+#include <hyx/sink.h>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include <signal.h>
+
+namespace {
+    std::atomic<bool> stop{false};
+
+    void on_signal(int)
+    {
+        stop.store(true, std::memory_order_relaxed);
+    }
+
+    // no SA_RESTART, so a signal also cuts the futex wait short
+    void handle_signal(int sig)
+    {
+        struct sigaction sa{};
+        sa.sa_handler = on_signal;
+        sigemptyset(&sa.sa_mask);
+        ::sigaction(sig, &sa, nullptr);
+    }
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    const bool compress = argc == 4 && std::string_view{argv[1]} == "-c";
+    if (argc != 3 && !compress) {
+        std::cerr << "usage: " << argv[0] << " [-c] <queue name> <log file>\n";
+        return 2;
+    }
+    const std::string queue_name = argv[argc - 2];
+    const char* log_file = argv[argc - 1];
+
+    handle_signal(SIGINT);
+    handle_signal(SIGTERM);
+
+    try {
+        std::unique_ptr<hyx::log_sink> sink;
+        if (compress) {
+            sink = std::make_unique<hyx::compressed_file_sink>(log_file, hyx::block_compression{});
+        }
+        else {
+            sink = std::make_unique<hyx::append_file_sink>(log_file);
+        }
+
+        hyx::detail::shm_log_mapping mapping(queue_name, false);
+        auto& q = mapping.queue();
+
+        const auto write = [&](std::string_view record) { sink->write(record, std::chrono::system_clock::now(), false); };
+        const auto drain = [&] {
+            bool any = false;
+            while (q.ring.try_pop(write)) {
+                any = true;
+            }
+            if (const auto n = q.dropped.exchange(0, std::memory_order_relaxed); n != 0) {
+                write(std::format("logd: dropped {} records, the queue was full\n", n));
+                any = true;
+            }
+            return any;
+        };
+
+        while (!stop.load(std::memory_order_relaxed)) {
+            if (drain()) {
+                continue;
+            }
+            // caught up, so whatever is batched goes out before sleeping
+            sink->flush();
+
+            // pairs with a producer bumping `pushes` before it looks at `sleeping`: either it
+            // sees the flag and wakes us, or the last look at the queue below sees its record
+            q.sleeping.store(1, std::memory_order_seq_cst);
+            const auto seen = q.pushes.load(std::memory_order_seq_cst);
+            if (!drain()) {
+                hyx::detail::futex_wait(q.pushes, seen, std::chrono::milliseconds{500});
+            }
+            q.sleeping.store(0, std::memory_order_relaxed);
+        }
+
+        drain();
+        sink->flush();
+    }
+    catch (const std::exception& e) {
+        std::cerr << argv[0] << ": " << e.what() << '\n';
+        return 1;
+    }
+}
@@ -0,0 +1,84 @@
+// <hyx/tools/logseek.cpp> -*- C++ -*-
+// Copyright (C) 2023 Michael Pollak
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+// usage: logseek <log file> <from> <to>
+// prints the part of a log written with hyx::sparse_time_index that covers [from, to),
+// where both times are utc in the form YYYY-MM-DDTHH:MM:SS
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <fstream>
+#include <hyx/time_index.h>
+#include <iostream>
+#include <optional>
+#include <sstream>
+#include <string>
+
+namespace {
+    std::optional<std::chrono::sys_seconds> parse_time(const char* str)
+    {
+        std::istringstream in{str};
+        std::chrono::sys_seconds t;
+        in >> std::chrono::parse("%FT%T", t);
+        if (!in) {
+            return std::nullopt;
+        }
+
+        return t;
+    }
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    if (argc != 4) {
+        std::cerr << "usage: " << argv[0] << " <log file> <from> <to>\n";
+        return 2;
+    }
+
+    const auto from = parse_time(argv[2]);
+    const auto to = parse_time(argv[3]);
+    if (!from || !to) {
+        std::cerr << "times must look like 2023-01-31T13:45:00\n";
+        return 2;
+    }
+    if (*from > *to) {
+        std::cerr << "usage: " << argv[0] << " <log file> <from> <to>\n"
+                  << "<from> must not be later than <to>\n";
+        return 2;
+    }
+
+    try {
+        hyx::time_index index(argv[1]);
+        auto [first, last] = index.find(*from, *to);
+
+        std::ifstream log(argv[1], std::ios_base::binary);
+        log.seekg(static_cast<std::streamoff>(first));
+
+        std::array<char, 64 * 1024> buf;
+        for (auto remaining = last - first; remaining != 0 && log;) {
+            log.read(buf.data(), static_cast<std::streamsize>(std::min<std::uint64_t>(remaining, buf.size())));
+            std::cout.write(buf.data(), log.gcount());
+            remaining -= static_cast<std::uint64_t>(log.gcount());
+        }
+    }
+    catch (const std::exception& e) {
+        std::cerr << argv[0] << ": " << e.what() << '\n';
+        return 1;
+    }
+}
@@ -0,0 +1,244 @@
+// <hyx/trace.h> -*- C++ -*-
+// Copyright (C) 2023 Michael Pollak
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef HYX_TRACE_H
+#define HYX_TRACE_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <hyx/logger.h>
+#include <hyx/sink.h>
+#include <iterator>
+#include <mutex>
+#include <source_location>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace hyx {
+    struct trace_event {
+        std::string name;
+        std::source_location loc;
+        std::chrono::steady_clock::time_point begin;
+        std::chrono::steady_clock::time_point end;
+        std::uint32_t tid;
+        std::uint32_t depth;
+    };
+
+    namespace detail {
+        // small, stable per-thread ids read better in trace viewers than std::thread::id
+        inline std::uint32_t trace_thread_id() noexcept
+        {
+            static constinit std::atomic<std::uint32_t> next_tid{1};
+            thread_local const std::uint32_t tid{next_tid.fetch_add(1, std::memory_order_relaxed)};
+            return tid;
+        }
+
+        // number of open spans on this thread
+        inline constinit thread_local std::uint32_t trace_depth{0};
+
+        template<typename OutIt>
+        constexpr OutIt json_escape_to(OutIt out, std::string_view str)
+        {
+            for (const char c : str) {
+                switch (c) {
+                case '"':
+                    out = std::ranges::copy("\\\""sv, out).out;
+                    break;
+                case '\\':
+                    out = std::ranges::copy("\\\\"sv, out).out;
+                    break;
+                case '\n':
+                    out = std::ranges::copy("\\n"sv, out).out;
+                    break;
+                case '\t':
+                    out = std::ranges::copy("\\t"sv, out).out;
+                    break;
+                default:
+                    if (static_cast<unsigned char>(c) < 0x20) {
+                        out = std::format_to(out, "\\u{:04x}", static_cast<unsigned>(c));
+                    }
+                    else {
+                        *out++ = c;
+                    }
+                    break;
+                }
+            }
+
+            return out;
+        }
+    } // namespace detail
+
+    // writes spans as chrome trace-event json (viewable in perfetto and chrome://tracing)
+    class trace_sink {
+    public:
+        // not copyable or movable
+        explicit trace_sink(const trace_sink&) = delete;
+        explicit trace_sink(trace_sink&&) = delete;
+        trace_sink& operator=(const trace_sink&) = delete;
+        trace_sink& operator=(trace_sink&&) = delete;
+
+        explicit trace_sink(const std::filesystem::path& path, std::size_t batch_size = 1024) : file_(detail::checked_log_path(path), std::ios_base::trunc), batch_size_(batch_size)
+        {
+            if (!file_) {
+                throw std::runtime_error("could not open trace output");
+            }
+
+            pending_.reserve(batch_size_);
+            file_ << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+            writer_ = std::jthread([this](std::stop_token st) { write_loop(st); });
+        }
+
+        ~trace_sink()
+        {
+            writer_.request_stop();
+            cv_.notify_one();
+            writer_.join();
+            file_ << "]}\n";
+        }
+
+        void submit(trace_event&& ev)
+        {
+            bool wake;
+            {
+                std::lock_guard lock(mutex_);
+                pending_.push_back(std::move(ev));
+                wake = pending_.size() >= batch_size_;
+            }
+
+            if (wake) {
+                cv_.notify_one();
+            }
+        }
+
+    private:
+        void write_loop(std::stop_token st)
+        {
+            std::vector<trace_event> batch;
+            batch.reserve(batch_size_);
+            std::string out;
+
+            while (true) {
+                {
+                    std::unique_lock lock(mutex_);
+                    cv_.wait_for(lock, std::chrono::milliseconds(100), [&] { return st.stop_requested() || pending_.size() >= batch_size_; });
+                    batch.swap(pending_);
+                }
+
+                for (const auto& ev : batch) {
+                    write_event(std::back_inserter(out), ev);
+                }
+                file_ << out;
+                file_.flush();
+                out.clear();
+                batch.clear();
+
+                if (st.stop_requested()) {
+                    std::lock_guard lock(mutex_);
+                    if (pending_.empty()) {
+                        return;
+                    }
+                }
+            }
+        }
+
+        template<typename OutIt>
+        OutIt write_event(OutIt out, const trace_event& ev)
+        {
+            using namespace std::chrono;
+
+            // complete ("X") events nest by time, so depth is only informational
+            const auto ts = duration<double, std::micro>(ev.begin - epoch_).count();
+            const auto dur = duration<double, std::micro>(ev.end - ev.begin).count();
+
+            if (!first_) {
+                *out++ = ',';
+            }
+            first_ = false;
+
+            out = std::ranges::copy("\n{\"ph\":\"X\",\"pid\":0,\"name\":\""sv, out).out;
+            out = detail::json_escape_to(out, ev.name);
+            out = std::format_to(out, "\",\"tid\":{},\"ts\":{:.3f},\"dur\":{:.3f},\"args\":{{\"depth\":{},\"line\":{},\"file\":\"", ev.tid, ts, dur, ev.depth, ev.loc.line());
+            out = detail::json_escape_to(out, ev.loc.file_name());
+            out = std::ranges::copy("\",\"function\":\""sv, out).out;
+            out = detail::json_escape_to(out, ev.loc.function_name());
+            return std::ranges::copy("\"}}"sv, out).out;
+        }
+
+        std::ofstream file_;
+        std::size_t batch_size_;
+        std::chrono::steady_clock::time_point epoch_{std::chrono::steady_clock::now()};
+        bool first_{true};
+
+        std::mutex mutex_;
+        std::condition_variable cv_;
+        std::vector<trace_event> pending_;
+        std::jthread writer_;
+    };
+
+    // records the time between its construction and destruction as a single span
+    class trace_span {
+    public:
+        // not copyable or movable
+        explicit trace_span(const trace_span&) = delete;
+        explicit trace_span(trace_span&&) = delete;
+        trace_span& operator=(const trace_span&) = delete;
+        trace_span& operator=(trace_span&&) = delete;
+
+        template<typename... Args>
+        explicit trace_span(trace_sink& sink, const format_string_with_location<std::type_identity_t<Args>...>& fmt, Args&&... args) : sink_(sink), loc_(fmt.loc)
+        {
+            // only pay for formatting when the name is not a plain literal ("{{" still needs unescaping)
+            const std::string_view str = fmt.fstr.get();
+            if (sizeof...(Args) == 0 && str.find_first_of("{}") == std::string_view::npos) {
+                name_ = str;
+            }
+            else {
+                name_ = std::format(fmt.fstr, std::forward<Args>(args)...);
+            }
+
+            // only once nothing can throw, as the destructor won't run to undo it otherwise
+            depth_ = detail::trace_depth++;
+            begin_ = std::chrono::steady_clock::now();
+        }
+
+        ~trace_span()
+        {
+            const auto end = std::chrono::steady_clock::now();
+            --detail::trace_depth;
+            sink_.submit({std::move(name_), loc_, begin_, end, detail::trace_thread_id(), depth_});
+        }
+
+    private:
+        trace_sink& sink_;
+        std::string name_;
+        std::source_location loc_;
+        std::uint32_t depth_{0};
+        std::chrono::steady_clock::time_point begin_;
+    };
+} // namespace hyx
+
+#endif // !HYX_TRACE_H